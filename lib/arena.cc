@@ -0,0 +1,87 @@
+#include "arena.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace metadata {
+
+// Blocks start at one huge page and double up to MAX_BLOCK.
+constexpr size_t HUGE_PAGE = size_t(2) << 20;
+constexpr size_t MAX_BLOCK = size_t(64) << 20;
+
+Arena::Arena(bool huge_pages) : huge_pages_(huge_pages), next_size_(HUGE_PAGE)
+{
+}
+
+Arena::~Arena()
+{
+    for (const auto& b : blocks_) {
+        munmap(b.base, b.size);
+    }
+}
+
+Arena::Block Arena::map(size_t size)
+{
+    size = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw bad_alloc();
+    }
+    if (huge_pages_) {
+        // Only a hint: without THP the block keeps normal pages.
+        madvise(p, size, MADV_HUGEPAGE);
+    }
+    return Block{static_cast<char *>(p), size};
+}
+
+void *Arena::do_allocate(size_t bytes, size_t align)
+{
+    lock_guard<mutex> g {m_};
+    size_t pad = -reinterpret_cast<uintptr_t>(cur_) & (align - 1);
+    if (cur_ == nullptr || pad + bytes > left_) {
+        auto b = map(max(bytes + align, next_size_));
+        next_size_ = min(next_size_ * 2, MAX_BLOCK);
+        blocks_.push_back(b);
+        cur_ = b.base;
+        left_ = b.size;
+        pad = 0;
+    }
+    void *p = cur_ + pad;
+    cur_ += pad + bytes;
+    left_ -= pad + bytes;
+    used_ += bytes;
+    return p;
+}
+
+void Arena::do_deallocate(void *, size_t, size_t)
+{
+}
+
+bool Arena::do_is_equal(const pmr::memory_resource& o) const noexcept
+{
+    return this == &o;
+}
+
+size_t Arena::used() const
+{
+    lock_guard<mutex> g {m_};
+    return used_;
+}
+
+size_t Arena::reserved() const
+{
+    lock_guard<mutex> g {m_};
+    size_t n = 0;
+    for (const auto& b : blocks_) {
+        n += b.size;
+    }
+    return n;
+}
+
+}
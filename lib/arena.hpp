@@ -0,0 +1,55 @@
+#ifndef INCLUDE_MERKLEFS_ARENA_
+#define INCLUDE_MERKLEFS_ARENA_
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+namespace metadata {
+
+/*
+ * Monotonic arena for metadata storage.
+ *
+ * Memory is taken from the system in large blocks and only returned
+ * when the arena is destroyed, so dropping everything allocated from
+ * it costs a few munmap()s, and objects allocated together sit next to
+ * each other. Blocks can be backed by transparent huge pages.
+ * Allocation is thread-safe; deallocation is a no-op, so containers
+ * that grow in place waste their old storage until the arena goes.
+ */
+class Arena : public std::pmr::memory_resource {
+  public:
+    explicit Arena(bool huge_pages = false);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Bytes handed out and bytes mapped from the system.
+    size_t used() const;
+    size_t reserved() const;
+
+  private:
+    struct Block {
+        char *base;
+        size_t size;
+    };
+
+    void *do_allocate(size_t bytes, size_t align) override;
+    void do_deallocate(void *p, size_t bytes, size_t align) override;
+    bool do_is_equal(const std::pmr::memory_resource& o) const
+        noexcept override;
+    Block map(size_t size);
+
+    bool huge_pages_;
+    mutable std::mutex m_;
+    std::vector<Block> blocks_;
+    char *cur_ = nullptr;
+    size_t left_ = 0;
+    size_t next_size_;
+    size_t used_ = 0;
+};
+
+}
+
+#endif
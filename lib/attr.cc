@@ -0,0 +1,21 @@
+#include "attr.hpp"
+
+using namespace std;
+
+namespace metadata {
+
+AttrTemplate::AttrTemplate(dev_t dev, uid_t uid, gid_t gid, timespec time,
+                           blksize_t blksize)
+{
+    attr_.st_dev = dev;
+    attr_.st_nlink = 1;
+    attr_.st_uid = uid;
+    attr_.st_gid = gid;
+    attr_.st_rdev = 0;
+    attr_.st_atim = time;
+    attr_.st_mtim = time;
+    attr_.st_ctim = time;
+    attr_.st_blksize = blksize;
+}
+
+}
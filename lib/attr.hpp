@@ -0,0 +1,47 @@
+#ifndef INCLUDE_MERKLEFS_ATTR_
+#define INCLUDE_MERKLEFS_ATTR_
+
+#include <ctime>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "image.hpp"
+
+namespace metadata {
+
+/*
+ * The attributes getattr and readdirplus replies report for an inode.
+ *
+ * Images are immutable and every inode of a mount has the same owner,
+ * device and times, so a reply is a copy of a template with the four
+ * fields that differ between inodes set from the image.
+ */
+class AttrTemplate {
+  public:
+    AttrTemplate() = default;
+    AttrTemplate(dev_t dev, uid_t uid, gid_t gid, timespec time,
+                 blksize_t blksize);
+
+    // Fill attr for inode iino of img, reported to the kernel as ino.
+    void fill(const Image& img, ino_t iino, ino_t ino,
+              struct stat& attr) const;
+
+  private:
+    struct stat attr_ {};
+};
+
+inline void AttrTemplate::fill(const Image& img, ino_t iino, ino_t ino,
+                               struct stat& attr) const
+{
+    auto size = img.size(iino);
+    attr = attr_;
+    attr.st_ino = ino;
+    attr.st_mode = img.mode(iino);
+    attr.st_size = size;
+    attr.st_blocks = (size + 511) / 512;
+}
+
+}
+
+#endif
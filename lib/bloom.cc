@@ -0,0 +1,81 @@
+#include "bloom.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace metadata {
+
+BloomFilter::BloomFilter(size_t keys, unsigned bits_per_key)
+    : nblocks_(max<size_t>(1, (keys * bits_per_key + 511) / 512)),
+      blocks_(new Block[nblocks_]()),
+      words_(blocks_[0].words),
+      keys_(0)
+{
+}
+
+BloomFilter::BloomFilter(const void *data, size_t nblocks, size_t keys)
+    : nblocks_(nblocks),
+      words_(static_cast<const uint64_t *>(data)),
+      keys_(keys)
+{
+}
+
+uint64_t BloomFilter::hash(uint64_t parent, string_view name)
+{
+    // FNV-1a over the name.
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : name) {
+        h = (h ^ c) * 0x100000001b3ull;
+    }
+    h ^= parent * 0x9e3779b97f4a7c15ull;
+    // Finalizer of MurmurHash3, so that nearby parents spread out.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t BloomFilter::block(uint64_t h) const
+{
+    return (unsigned __int128)h * nblocks_ >> 64;
+}
+
+// The bits within a block come from a second multiply, 9 bits per probe.
+static inline uint64_t bit(uint64_t g, unsigned i)
+{
+    return uint64_t(1) << ((g >> (9 * i)) & 63);
+}
+
+static inline unsigned word(uint64_t g, unsigned i)
+{
+    return (g >> (9 * i + 6)) & 7;
+}
+
+void BloomFilter::add(uint64_t parent, string_view name)
+{
+    uint64_t h = hash(parent, name);
+    uint64_t g = h * 0xc2b2ae3d27d4eb4full;
+    auto& b = blocks_[block(h)];
+    for (unsigned i = 0; i < K; ++i) {
+        b.words[word(g, i)] |= bit(g, i);
+    }
+    ++keys_;
+}
+
+bool BloomFilter::may_contain(uint64_t parent, string_view name) const
+{
+    uint64_t h = hash(parent, name);
+    uint64_t g = h * 0xc2b2ae3d27d4eb4full;
+    const uint64_t *b = words_ + block(h) * 8;
+    for (unsigned i = 0; i < K; ++i) {
+        if (!(b[word(g, i)] & bit(g, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef INCLUDE_MERKLEFS_BLOOM_
+#define INCLUDE_MERKLEFS_BLOOM_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace metadata {
+
+/*
+ * Blocked Bloom filter over (parent ino, name) pairs.
+ *
+ * Every key sets K bits in a single 64-byte block, so a query costs one
+ * hash and at most one cache miss. That is cheap next to a directory
+ * search, which is what lets most lookups of names that do not exist
+ * return before touching any directory. At 10 bits per key the false
+ * positive rate is about 1%.
+ *
+ * Images store the filter they are written with, so the hash is fixed
+ * rather than std::hash, and a filter can be a view of stored blocks.
+ */
+class BloomFilter {
+  public:
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    explicit BloomFilter(size_t keys, unsigned bits_per_key = 10);
+    // A read-only view of nblocks blocks at data, 8-byte aligned, that
+    // hold keys keys. add() is not allowed on a view.
+    BloomFilter(const void *data, size_t nblocks, size_t keys);
+
+    void add(uint64_t parent, std::string_view name);
+    bool may_contain(uint64_t parent, std::string_view name) const;
+
+    size_t keys() const { return keys_; }
+    size_t blocks() const { return nblocks_; }
+    const void* data() const { return words_; }
+    // Bytes used by the filter.
+    size_t memory() const { return nblocks_ * BLOCK_SIZE; }
+
+  private:
+    static constexpr unsigned K = 7;
+
+    struct alignas(BLOCK_SIZE) Block {
+        uint64_t words[8];
+    };
+    static_assert(sizeof(Block) == BLOCK_SIZE);
+
+    static uint64_t hash(uint64_t parent, std::string_view name);
+    size_t block(uint64_t h) const;
+
+    size_t nblocks_;
+    std::unique_ptr<Block[]> blocks_;
+    const uint64_t *words_;
+    size_t keys_ = 0;
+};
+
+}
+
+#endif
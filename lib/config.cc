@@ -17,10 +17,18 @@ Config::Config(const string& path) {
     pool_ = j["pool"];
     remote_ = j["remote"];
     fetcher_ = j["fetcher"];
+    threads_ = j.value("threads", 0u);
+    max_idle_threads_ = j.value("max_idle_threads", 10u);
+    clone_fd_ = j.value("clone_fd", false);
+    pin_threads_ = j.value("pin_threads", false);
 }
 
 Config::~Config() {}
 
 const string& Config::pool() { return pool_; }
 const string& Config::remote() { return remote_; }
-const string& Config::fetcher() { return fetcher_; }
\ No newline at end of file
+const string& Config::fetcher() { return fetcher_; }
+unsigned Config::threads() { return threads_; }
+unsigned Config::max_idle_threads() { return max_idle_threads_; }
+bool Config::clone_fd() { return clone_fd_; }
+bool Config::pin_threads() { return pin_threads_; }
\ No newline at end of file
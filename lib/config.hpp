@@ -11,11 +11,25 @@ class Config {
     const std::string& pool();
     const std::string& remote();
     const std::string& fetcher();
+    // Worker threads. 0 leaves them to libfuse, which starts and stops
+    // them with the load; otherwise a fixed pool of this many is used.
+    unsigned threads();
+    // Idle threads libfuse keeps around, when threads is 0.
+    unsigned max_idle_threads();
+    // Give each libfuse worker its own /dev/fuse fd. Only with threads
+    // 0: merklefs refuses to start with both set.
+    bool clone_fd();
+    // Pin the fixed pool to CPUs, one worker per CPU in turn.
+    bool pin_threads();
 
   private:
     std::string pool_;
     std::string remote_;
     std::string fetcher_;
+    unsigned threads_;
+    unsigned max_idle_threads_;
+    bool clone_fd_;
+    bool pin_threads_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "diff.hpp"
+
+#include <algorithm>
+#include <system_error>
+#include <unordered_set>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace metadata {
+
+namespace {
+
+class Differ {
+  public:
+    Differ(const Image& a, const Image& b) : a_(a), b_(b) {}
+    Diff run();
+
+  private:
+    typedef unordered_set<Digest, DigestHash> DigestSet;
+
+    static DirentTable listing(const Image& img, ino_t ino,
+                               const string& path);
+    static void collect(const Image& img, ino_t ino, const string& path,
+                        vector<string>& paths, DigestSet& blobs);
+    void walk(ino_t ai, ino_t bi, const string& path);
+    void match(ino_t ai, ino_t bi, const string& path);
+
+    const Image& a_;
+    const Image& b_;
+    Diff diff_;
+    DigestSet old_;
+    DigestSet new_;
+};
+
+DirentTable Differ::listing(const Image& img, ino_t ino, const string& path)
+{
+    int err = img.fault(ino);
+    if (err != 0) {
+        throw system_error(err, generic_category(),
+                           "diff: " + (path.empty() ? "/" : path));
+    }
+    return img.dirents(ino);
+}
+
+void Differ::collect(const Image& img, ino_t ino, const string& path,
+                     vector<string>& paths, DigestSet& blobs)
+{
+    paths.push_back(path);
+    if (img.is_reg(ino)) {
+        blobs.insert(img.gethash(ino));
+    } else if (img.is_dir(ino)) {
+        for (const auto& d : listing(img, ino, path)) {
+            collect(img, d.ino, path + "/" + string(img.name(d)),
+                    paths, blobs);
+        }
+    }
+}
+
+void Differ::match(ino_t ai, ino_t bi, const string& path)
+{
+    if (a_.is_dir(ai) && b_.is_dir(bi)) {
+        // The tree digest covers the directory itself and everything
+        // below it.
+        if (a_.gethash(ai) == b_.gethash(bi)) {
+            return;
+        }
+        if (!same_entry(a_, ai, b_, bi)) {
+            diff_.changed.push_back(path.empty() ? "/" : path);
+        }
+        walk(ai, bi, path);
+    } else if (!a_.is_dir(ai) && !b_.is_dir(bi)
+               && (a_.mode(ai) & S_IFMT) == (b_.mode(bi) & S_IFMT)) {
+        if (same_entry(a_, ai, b_, bi)) {
+            return;
+        }
+        diff_.changed.push_back(path);
+        if (a_.is_reg(ai)) {
+            old_.insert(a_.gethash(ai));
+            new_.insert(b_.gethash(bi));
+        }
+    } else {
+        collect(a_, ai, path, diff_.removed, old_);
+        collect(b_, bi, path, diff_.added, new_);
+    }
+}
+
+void Differ::walk(ino_t ai, ino_t bi, const string& path)
+{
+    auto ta = listing(a_, ai, path);
+    auto tb = listing(b_, bi, path);
+    size_t i = 0, j = 0;
+    while (i < ta.size() || j < tb.size()) {
+        int c = i == ta.size() ? 1 : j == tb.size() ? -1
+              : a_.name(ta[i]).compare(b_.name(tb[j]));
+        if (c < 0) {
+            collect(a_, ta[i].ino, path + "/" + string(a_.name(ta[i])),
+                    diff_.removed, old_);
+            i++;
+        } else if (c > 0) {
+            collect(b_, tb[j].ino, path + "/" + string(b_.name(tb[j])),
+                    diff_.added, new_);
+            j++;
+        } else {
+            match(ta[i].ino, tb[j].ino,
+                  path + "/" + string(b_.name(tb[j])));
+            i++;
+            j++;
+        }
+    }
+}
+
+Diff Differ::run()
+{
+    match(a_.root(), b_.root(), "");
+    for (const auto& d : new_) {
+        if (!old_.count(d)) {
+            diff_.blobs.push_back(d);
+        }
+    }
+    sort(diff_.blobs.begin(), diff_.blobs.end());
+    return move(diff_);
+}
+
+}
+
+bool same_entry(const Image& a, ino_t ai, const Image& b, ino_t bi)
+{
+    if (a.mode(ai) != b.mode(bi) || a.size(ai) != b.size(bi)) {
+        return false;
+    }
+    if (a.is_reg(ai)) {
+        return a.gethash(ai) == b.gethash(bi);
+    }
+    if (a.is_lnk(ai)) {
+        return a.readlink(ai) == b.readlink(bi);
+    }
+    return true;
+}
+
+Diff diff(const Image& from, const Image& to)
+{
+    return Differ(from, to).run();
+}
+
+}
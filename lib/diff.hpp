@@ -0,0 +1,37 @@
+#ifndef INCLUDE_MERKLEFS_DIFF_
+#define INCLUDE_MERKLEFS_DIFF_
+
+#include <string>
+#include <vector>
+
+#include "digest.hpp"
+#include "image.hpp"
+
+namespace metadata {
+
+// Changes between two images. Paths are absolute within the mount and
+// listed in walk order; an entry whose type changed is both removed
+// and added.
+struct Diff {
+    std::vector<std::string> added;
+    std::vector<std::string> removed;
+    std::vector<std::string> changed;
+    // Contents of added or changed files, except those that removed or
+    // changed entries already had (moved files). Sorted.
+    std::vector<Digest> blobs;
+};
+
+// True if entry ai of a and entry bi of b look the same: same mode and
+// size, and the same content for files and target for symlinks. For
+// directories only the directory itself is compared, not its listing.
+bool same_entry(const Image& a, ino_t ai, const Image& b, ino_t bi);
+
+// Walk both trees together, skipping directories whose tree digests
+// are equal, so the cost is proportional to the change rather than to
+// the images. Lazy images only load the trees that differ. Throws
+// std::system_error if a tree cannot be loaded.
+Diff diff(const Image& from, const Image& to);
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "digest.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <openssl/evp.h>
+
+using namespace std;
+
+static int unhex(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+bool digest_from_hex(string_view hex, Digest& d)
+{
+    if (hex.size() != DIGEST_HEX_LEN) {
+        return false;
+    }
+    for (size_t i = 0; i < d.size(); ++i) {
+        int hi = unhex(hex[2 * i]), lo = unhex(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        d[i] = hi << 4 | lo;
+    }
+    return true;
+}
+
+#ifdef __SSE2__
+
+// Expand 16 bytes into 32 hex digits at a time: split the nibbles,
+// interleave them in output order and map 0-9/10-15 to '0'-'9'/'a'-'f'.
+static void hex16(const uint8_t *in, char *out)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+    __m128i a = _mm_unpacklo_epi8(hi, lo);
+    __m128i b = _mm_unpackhi_epi8(hi, lo);
+    a = _mm_add_epi8(_mm_add_epi8(a, zero),
+                     _mm_and_si128(_mm_cmpgt_epi8(a, nine), alpha));
+    b = _mm_add_epi8(_mm_add_epi8(b, zero),
+                     _mm_and_si128(_mm_cmpgt_epi8(b, nine), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), b);
+}
+
+void digest_to_hex(const Digest& d, char *out)
+{
+    hex16(d.data(), out);
+    hex16(d.data() + 16, out + 32);
+}
+
+#else
+
+void digest_to_hex(const Digest& d, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (auto b : d) {
+        *out++ = digits[b >> 4];
+        *out++ = digits[b & 0x0f];
+    }
+}
+
+#endif
+
+string digest_to_hex(const Digest& d)
+{
+    string s(DIGEST_HEX_LEN, '\0');
+    digest_to_hex(d, s.data());
+    return s;
+}
+
+Digest digest_sha256(string_view data)
+{
+    Digest d;
+    EVP_Digest(data.data(), data.size(), d.data(), nullptr, EVP_sha256(),
+               nullptr);
+    return d;
+}
@@ -0,0 +1,35 @@
+#ifndef INCLUDE_MERKLEFS_DIGEST_
+#define INCLUDE_MERKLEFS_DIGEST_
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Raw SHA-256 content hash. Blobs in the pool are named by its hex form.
+typedef std::array<uint8_t, 32> Digest;
+
+constexpr size_t DIGEST_HEX_LEN = 2 * sizeof(Digest);
+
+// Digests are uniformly distributed, so any 8 bytes make a good hash.
+struct DigestHash {
+    size_t operator()(const Digest& d) const
+    {
+        size_t h;
+        memcpy(&h, d.data(), sizeof(h));
+        return h;
+    }
+};
+
+// Parse 64 hex digits (either case); returns false on malformed input.
+bool digest_from_hex(std::string_view hex, Digest& d);
+
+// Write 64 lowercase hex digits to out; no terminator is added.
+void digest_to_hex(const Digest& d, char *out);
+
+std::string digest_to_hex(const Digest& d);
+
+Digest digest_sha256(std::string_view data);
+
+#endif
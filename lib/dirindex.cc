@@ -0,0 +1,40 @@
+#include "dirindex.hpp"
+
+#include <cstring>
+
+using namespace std;
+
+namespace metadata {
+
+DirIndex::DirIndex(size_t n, const Names& names) : groups_(1)
+{
+    // At most 7/8 full, so that every probe sequence ends at an EMPTY.
+    while (groups_ * GROUP * 7 < n * 8) {
+        groups_ *= 2;
+    }
+    ctrl_.reset(new uint8_t[groups_ * GROUP]);
+    slots_.reset(new uint32_t[groups_ * GROUP]);
+    memset(ctrl_.get(), EMPTY, groups_ * GROUP);
+
+    size_t mask = groups_ - 1;
+    for (size_t i = 0; i < n; ++i) {
+        size_t h = hash(names(i));
+        size_t g = (h >> 7) & mask;
+        for (size_t step = 1;; g = (g + step++) & mask) {
+            uint32_t m = match(&ctrl_[g * GROUP], EMPTY);
+            if (m != 0) {
+                size_t slot = g * GROUP + __builtin_ctz(m);
+                ctrl_[slot] = h & 0x7f;
+                slots_[slot] = i;
+                break;
+            }
+        }
+    }
+}
+
+size_t DirIndex::memory() const
+{
+    return groups_ * GROUP * (sizeof(uint8_t) + sizeof(uint32_t));
+}
+
+}
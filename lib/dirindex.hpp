@@ -0,0 +1,97 @@
+#ifndef INCLUDE_MERKLEFS_DIRINDEX_
+#define INCLUDE_MERKLEFS_DIRINDEX_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace metadata {
+
+/*
+ * Hash index over the entries of one large directory.
+ *
+ * Sorted dirents are searched in O(log n) string compares, each a
+ * likely cache miss once a directory has many thousands of entries.
+ * This is an open-addressing table in the style of Swiss tables:
+ * slots come in groups of 16 with one control byte each, holding 7
+ * bits of the name hash or EMPTY. A probe compares a whole group of
+ * control bytes at once, so a lookup usually costs one hash, one group
+ * and one string compare. Slots hold positions in the dirent table;
+ * the index never changes once built.
+ */
+class DirIndex {
+  public:
+    typedef std::function<std::string_view(size_t)> Names;
+
+    // Index entries 0..n-1, where names(i) is the name of entry i.
+    DirIndex(size_t n, const Names& names);
+
+    // Returns the position of s, or SIZE_MAX if it is not there.
+    template <class Name>
+    size_t find(std::string_view s, Name name) const;
+
+    // Bytes used by the index.
+    size_t memory() const;
+
+  private:
+    static constexpr size_t GROUP = 16;
+    static constexpr uint8_t EMPTY = 0x80;
+
+    static size_t hash(std::string_view s);
+    // Bit i is set if control byte i of the group equals tag.
+    static uint32_t match(const uint8_t *ctrl, uint8_t tag);
+
+    size_t groups_;
+    std::unique_ptr<uint8_t[]> ctrl_;
+    std::unique_ptr<uint32_t[]> slots_;
+};
+
+inline size_t DirIndex::hash(std::string_view s)
+{
+    return std::hash<std::string_view>()(s);
+}
+
+inline uint32_t DirIndex::match(const uint8_t *ctrl, uint8_t tag)
+{
+#ifdef __SSE2__
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(tag)));
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < GROUP; ++i) {
+        bits |= uint32_t(ctrl[i] == tag) << i;
+    }
+    return bits;
+#endif
+}
+
+template <class Name>
+size_t DirIndex::find(std::string_view s, Name name) const
+{
+    size_t h = hash(s);
+    uint8_t tag = h & 0x7f;
+    size_t mask = groups_ - 1;
+    size_t g = (h >> 7) & mask;
+    for (size_t step = 1;; g = (g + step++) & mask) {
+        const uint8_t *ctrl = &ctrl_[g * GROUP];
+        for (uint32_t m = match(ctrl, tag); m != 0; m &= m - 1) {
+            uint32_t pos = slots_[g * GROUP + __builtin_ctz(m)];
+            if (name(pos) == s) {
+                return pos;
+            }
+        }
+        if (match(ctrl, EMPTY) != 0) {
+            return SIZE_MAX;
+        }
+    }
+}
+
+}
+
+#endif
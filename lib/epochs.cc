@@ -0,0 +1,94 @@
+#include "epochs.hpp"
+
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace metadata {
+
+// The slot the calling thread last read through, given back when the
+// thread exits.
+struct Epochs::Local {
+    const Epochs *owner = nullptr;
+    Reader *reader = nullptr;
+
+    ~Local()
+    {
+        if (owner) {
+            owner->release(reader);
+        }
+    }
+};
+
+static int membarrier(int cmd)
+{
+    return syscall(__NR_membarrier, cmd, 0, 0);
+}
+
+Epochs::Epochs()
+    : fence_(membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED) != 0)
+{
+}
+
+uint64_t Epochs::advance()
+{
+    return epoch_.fetch_add(1) + 1;
+}
+
+bool Epochs::quiet(uint64_t epoch) const
+{
+    if (!fence_) {
+        membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED);
+    }
+    lock_guard<mutex> g {readers_mutex_};
+    for (const auto& r : readers_) {
+        auto e = r.epoch.load();
+        if (e != 0 && e < epoch) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Epochs::readers() const
+{
+    lock_guard<mutex> g {readers_mutex_};
+    return readers_.size();
+}
+
+// The first read of a thread through this Epochs.
+atomic<uint64_t>* Epochs::claim() const
+{
+    static thread_local Local local;
+    if (local.owner) {
+        local.owner->release(local.reader);
+    }
+    {
+        lock_guard<mutex> g {readers_mutex_};
+        local.reader = nullptr;
+        for (auto& r : readers_) {
+            if (!r.used) {
+                local.reader = &r;
+                break;
+            }
+        }
+        if (!local.reader) {
+            local.reader = &readers_.emplace_back();
+        }
+        local.reader->used = true;
+    }
+    local.owner = this;
+    local_owner_ = this;
+    local_slot_ = &local.reader->epoch;
+    return local_slot_;
+}
+
+void Epochs::release(Reader *r) const
+{
+    lock_guard<mutex> g {readers_mutex_};
+    r->used = false;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef INCLUDE_MERKLEFS_EPOCHS_
+#define INCLUDE_MERKLEFS_EPOCHS_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace metadata {
+
+/*
+ * Deferred reclamation of objects that are published through an atomic
+ * pointer and read without a lock or a shared reference count.
+ *
+ * A reader holds a Guard while it loads the pointer and uses the object.
+ * The guard marks the reader's own slot with the current epoch, so
+ * readers do not write to any shared cache line. A writer that replaces
+ * the pointer calls advance() and keeps the old object until quiet() is
+ * true for the epoch it returned: by then every reader that may have
+ * loaded the old pointer has dropped its guard.
+ *
+ * Entering a guard is a store to the slot without a fence: quiet() has
+ * the kernel put a barrier on every reader thread (membarrier(2)), which
+ * is cheap for a writer that is rare. Where membarrier is not available
+ * readers fence instead.
+ *
+ * Each thread has one slot per Epochs, which it reuses once the thread
+ * exits. A thread reads through one Epochs at a time, and the Epochs has
+ * to outlive the threads that read through it.
+ */
+class Epochs {
+  public:
+    class Guard {
+      public:
+        explicit Guard(const Epochs& epochs);
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+      private:
+        // Null for a guard taken inside another one.
+        std::atomic<uint64_t> *slot_;
+    };
+
+    Epochs();
+    Epochs(const Epochs&) = delete;
+    Epochs& operator=(const Epochs&) = delete;
+
+    // Starts a new epoch and returns it. Call after the pointer to an
+    // object is replaced, and keep the object until quiet() is true.
+    uint64_t advance();
+    // True if no reader is still in an epoch before epoch.
+    bool quiet(uint64_t epoch) const;
+    // Number of thread slots, in use or not.
+    size_t readers() const;
+
+  private:
+    struct alignas(64) Reader {
+        // The epoch the reader entered, or 0 outside a guard.
+        std::atomic<uint64_t> epoch {0};
+        bool used = false;
+    };
+    struct Local;
+
+    std::atomic<uint64_t>* slot() const;
+    std::atomic<uint64_t>* claim() const;
+    void release(Reader *r) const;
+
+    // The slot of the calling thread, for the Epochs it last read
+    // through.
+    static inline thread_local const Epochs *local_owner_ = nullptr;
+    static inline thread_local std::atomic<uint64_t> *local_slot_ = nullptr;
+
+    std::atomic<uint64_t> epoch_ {1};
+    // Set if readers fence themselves, without membarrier(2).
+    const bool fence_;
+    mutable std::mutex readers_mutex_;
+    // A deque keeps the slots in place as threads are added.
+    mutable std::deque<Reader> readers_;
+};
+
+inline std::atomic<uint64_t>* Epochs::slot() const
+{
+    return local_owner_ == this ? local_slot_ : claim();
+}
+
+inline Epochs::Guard::Guard(const Epochs& epochs) : slot_(epochs.slot())
+{
+    if (slot_->load(std::memory_order_relaxed) != 0) {
+        slot_ = nullptr;
+        return;
+    }
+    // A reader that sees the epoch advance() returned loads the pointer
+    // stored before it.
+    slot_->store(epochs.epoch_.load(std::memory_order_acquire),
+                 std::memory_order_relaxed);
+    // The slot has to be visible before the pointer is loaded. quiet()
+    // has the kernel run that barrier on every reader, so readers only
+    // fence on their own where it cannot.
+    if (epochs.fence_) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    } else {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+}
+
+inline Epochs::Guard::~Guard()
+{
+    if (slot_) {
+        slot_->store(0, std::memory_order_release);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,171 @@
+#include "files.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace metadata {
+
+FileTable::~FileTable()
+{
+    for (auto& s : shards_) {
+        for (auto& [digest, f] : s.files) {
+            if (f.fd >= 0) {
+                close(f.fd);
+            }
+        }
+    }
+}
+
+void FileTable::set_idle_limit(size_t n)
+{
+    idle_limit_ = n == 0 ? 0 : max<size_t>(1, n >> SHARD_BITS);
+}
+
+int FileTable::acquire(const Digest& digest, const Opener& open)
+{
+    auto& s = shard(digest);
+    File *f;
+    {
+        lock_guard<mutex> g {s.m};
+        f = &s.files[digest];
+        if (f->fd.load(memory_order_relaxed) >= 0) {
+            if (f->refs == 0) {
+                s.idle.erase(f->idle);
+            }
+            ++s.hits;
+        }
+        ++f->refs;
+    }
+    // The reference keeps the entry in place until it is released.
+    int fd = f->fd.load(memory_order_acquire);
+    if (fd >= 0) {
+        return fd;
+    }
+    {
+        lock_guard<mutex> g {f->m};
+        fd = f->fd.load(memory_order_relaxed);
+        if (fd < 0) {
+            fd = try_open(s, open);
+            if (fd >= 0) {
+                f->fd.store(fd, memory_order_release);
+            } else {
+                fd = -errno;
+            }
+        }
+    }
+    if (fd < 0) {
+        unref(digest, ANY_FD);
+    }
+    return fd;
+}
+
+int FileTable::try_open(Shard& s, const Opener& open)
+{
+    s.opens.fetch_add(1, memory_order_relaxed);
+    int fd = open();
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+        int err = errno;
+        if (shed() == 0) {
+            errno = err;
+            return fd;
+        }
+        s.opens.fetch_add(1, memory_order_relaxed);
+        fd = open();
+    }
+    return fd;
+}
+
+bool FileTable::release(const Digest& digest, int fd)
+{
+    return fd >= 0 && unref(digest, fd);
+}
+
+bool FileTable::unref(const Digest& digest, int fd)
+{
+    auto& s = shard(digest);
+    int last = -1;
+    {
+        lock_guard<mutex> g {s.m};
+        auto it = s.files.find(digest);
+        if (it == s.files.end() || it->second.refs == 0) {
+            return false;
+        }
+        auto& f = it->second;
+        if (fd != ANY_FD && f.fd.load(memory_order_relaxed) != fd) {
+            return false;
+        }
+        if (--f.refs == 0) {
+            if (f.fd.load(memory_order_relaxed) >= 0 && idle_limit_ > 0) {
+                s.idle.push_front(digest);
+                f.idle = s.idle.begin();
+                if (s.idle.size() <= idle_limit_) {
+                    return true;
+                }
+                it = s.files.find(s.idle.back());
+                s.idle.pop_back();
+                ++s.evictions;
+            }
+            last = it->second.fd;
+            s.files.erase(it);
+        }
+    }
+    // Close outside the lock, other digests in the shard need not wait.
+    if (last >= 0) {
+        close(last);
+    }
+    return true;
+}
+
+size_t FileTable::shed()
+{
+    size_t n = 0;
+    vector<int> fds;
+    for (auto& s : shards_) {
+        {
+            lock_guard<mutex> g {s.m};
+            for (const auto& digest : s.idle) {
+                auto it = s.files.find(digest);
+                fds.push_back(it->second.fd);
+                s.files.erase(it);
+            }
+            s.evictions += s.idle.size();
+            s.idle.clear();
+        }
+        for (int fd : fds) {
+            close(fd);
+        }
+        n += fds.size();
+        fds.clear();
+    }
+    return n;
+}
+
+size_t FileTable::size() const
+{
+    size_t n = 0;
+    for (const auto& s : shards_) {
+        lock_guard<mutex> g {s.m};
+        n += s.files.size();
+    }
+    return n;
+}
+
+FileTable::Stats FileTable::stats() const
+{
+    Stats st {};
+    for (const auto& s : shards_) {
+        lock_guard<mutex> g {s.m};
+        st.hits += s.hits;
+        st.opens += s.opens.load(memory_order_relaxed);
+        st.evictions += s.evictions;
+        st.idle += s.idle.size();
+    }
+    return st;
+}
+
+}
@@ -0,0 +1,104 @@
+#ifndef INCLUDE_MERKLEFS_FILES_
+#define INCLUDE_MERKLEFS_FILES_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "digest.hpp"
+
+namespace metadata {
+
+/*
+ * Open pool files, by content.
+ *
+ * Every open of the same digest shares one descriptor, whichever inode
+ * it comes through, so duplicated files (vendored copies, licenses,
+ * wheels) cost one descriptor and one open() between them. Each open
+ * holds a reference.
+ *
+ * The table is split into shards by digest, each with its own lock, which
+ * is only held to find an entry and count references. Opening happens
+ * under a per-entry lock, so a slow open (or fetch) only holds up
+ * other opens of the same file. Once a file is open, further opens of
+ * it take just the shard lock.
+ *
+ * When the last reference is released the descriptor is kept open as
+ * idle, so files that are opened over and over (headers, shared
+ * libraries) skip open() after the first time. Idle descriptors are
+ * closed least recently used first once there are more than the idle
+ * limit, and all at once if an open fails for lack of descriptors.
+ */
+class FileTable {
+  public:
+    // Returns an open descriptor or -1 and sets errno.
+    using Opener = std::function<int()>;
+
+    struct Stats {
+        size_t hits;        // acquired while open or idle
+        size_t opens;       // calls to open
+        size_t evictions;   // idle descriptors closed
+        size_t idle;
+    };
+
+    FileTable() = default;
+    FileTable(const FileTable&) = delete;
+    FileTable& operator=(const FileTable&) = delete;
+    ~FileTable();
+
+    // Returns the descriptor for digest, calling open if it is not open
+    // yet, or -errno if that fails. Each success must be released.
+    int acquire(const Digest& digest, const Opener& open);
+    // Drops a reference taken by acquire(). Returns false if digest is
+    // not open with fd.
+    bool release(const Digest& digest, int fd);
+
+    // Keep up to n descriptors open after their last release. Must be
+    // set before the table is used; the default is 0.
+    void set_idle_limit(size_t n);
+    // Close every idle descriptor, returns how many there were.
+    size_t shed();
+
+    // Number of open digests, idle ones included.
+    size_t size() const;
+    Stats stats() const;
+
+  private:
+    static constexpr unsigned SHARD_BITS = 6;
+    static constexpr int ANY_FD = -1;
+
+    struct File {
+        std::mutex m;           // held while opening
+        std::atomic<int> fd {-1};
+        // Guarded by the shard lock; idle is set while refs is 0.
+        unsigned refs = 0;
+        std::list<Digest>::iterator idle;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex m;
+        std::unordered_map<Digest, File, DigestHash> files;
+        std::list<Digest> idle;     // most recently released first
+        size_t hits = 0;
+        size_t evictions = 0;
+        std::atomic<size_t> opens {0};
+    };
+
+    // DigestHash picks buckets from the first bytes, shards use the last.
+    Shard& shard(const Digest& digest)
+    {
+        return shards_[digest.back() >> (8 - SHARD_BITS)];
+    }
+    bool unref(const Digest& digest, int fd);
+    int try_open(Shard& s, const Opener& open);
+
+    Shard shards_[1 << SHARD_BITS];
+    size_t idle_limit_ = 0;     // per shard
+};
+
+}
+
+#endif
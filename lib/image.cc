@@ -0,0 +1,746 @@
+#include "image.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metadata.hpp"
+#include "names.hpp"
+#include "path.hpp"
+
+using namespace std;
+
+namespace metadata {
+
+static uint64_t align8(uint64_t n)
+{
+    return (n + 7) & ~uint64_t(7);
+}
+
+static uint64_t align64(uint64_t n)
+{
+    return (n + 63) & ~uint64_t(63);
+}
+
+Image::Image(const string& path) : mapped_(true)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw system_error(errno, generic_category(), path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        close(fd);
+        throw system_error(err, generic_category(), path);
+    }
+    void *p = MAP_FAILED;
+    if (st.st_size > 0) {
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    int err = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        throw system_error(st.st_size ? err : EINVAL, generic_category(), path);
+    }
+    try {
+        attach(static_cast<const char *>(p), st.st_size);
+        reserve_indexes(header_.ninodes);
+    } catch (...) {
+        munmap(p, st.st_size);
+        throw;
+    }
+}
+
+unique_ptr<Image> Image::from_string(string data)
+{
+    unique_ptr<Image> img {new Image};
+    img->data_ = move(data);
+    img->attach(img->data_.data(), img->data_.size());
+    img->reserve_indexes(img->header_.ninodes);
+    return img;
+}
+
+unique_ptr<Image> Image::open_tree(const Digest& root, const string& pool,
+                                   Fetch fetch)
+{
+    // 16 GiB of address space per section; pages are only committed
+    // as directories are loaded.
+    const size_t cap = size_t(1) << 34;
+
+    unique_ptr<Image> img {new Image};
+    img->lazy_ = true;
+    img->pool_ = pool;
+    img->fetch_ = move(fetch);
+    for (auto& r : img->regions_) {
+        void *p = mmap(nullptr, cap, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw system_error(errno, generic_category(), "mmap");
+        }
+        r.base = static_cast<char *>(p);
+        r.cap = cap;
+    }
+    auto& h = img->header_;
+    h.flags = IMAGE_TREE;
+    h.root_ino = 1;
+    h.ndirents = cap / sizeof(DirentRecord);
+    h.ndigests = cap / sizeof(Digest);
+    h.strings_size = cap;
+    img->inodes_ = reinterpret_cast<const InodeRecord *>(img->regions_[0].base);
+    img->dirents_ = reinterpret_cast<const DirentRecord *>(img->regions_[1].base);
+    img->digests_ = reinterpret_cast<const Digest *>(img->regions_[2].base);
+    img->strings_ = img->regions_[3].base;
+    img->reserve_indexes(cap / sizeof(InodeRecord));
+
+    InodeRecord r {S_IFDIR | 0755, INODE_LAZY, 0, 0, 0, 0};
+    img->regions_[0].append(&r, sizeof(r));
+    img->regions_[2].append(&root, sizeof(root));
+    img->ninodes_ = 1;
+
+    // Load the root eagerly so that a missing tree fails the mount.
+    mode_t mode;
+    unique_ptr<Image> tree;
+    int err = img->read_tree(img->inodes_[0], tree);
+    if (err == 0) {
+        err = img->add_tree(img->inodes_[0], *tree, &mode);
+    }
+    if (err != 0) {
+        throw system_error(err, generic_category(),
+                           "tree " + digest_to_hex(root));
+    }
+    const_cast<InodeRecord *>(img->inodes_)->mode = mode;
+    return img;
+}
+
+Image::~Image()
+{
+    if (mapped_) {
+        munmap(const_cast<char *>(base_), len_);
+    }
+    for (auto& r : regions_) {
+        if (r.base != nullptr) {
+            munmap(r.base, r.cap);
+        }
+    }
+    if (indexes_ != nullptr) {
+        munmap(indexes_, nindexes_ * sizeof(*indexes_));
+    }
+}
+
+void Image::attach(const char *base, size_t len)
+{
+    base_ = base;
+    len_ = len;
+    if (len < sizeof(ImageHeader)) {
+        throw runtime_error("image: truncated header");
+    }
+    memcpy(&header_, base, sizeof(header_));
+    if (memcmp(header_.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+        throw runtime_error("image: bad magic");
+    }
+    if (header_.version != IMAGE_VERSION) {
+        throw runtime_error("image: unsupported version "
+                            + to_string(header_.version));
+    }
+    auto in_bounds = [len](uint64_t off, uint64_t count, uint64_t size) {
+        return off % 8 == 0 && off <= len
+            && count <= (len - off) / size;
+    };
+    if (header_.ninodes == 0
+        || !in_bounds(header_.inodes_off, header_.ninodes, sizeof(InodeRecord))
+        || !in_bounds(header_.dirents_off, header_.ndirents, sizeof(DirentRecord))
+        || !in_bounds(header_.digests_off, header_.ndigests, sizeof(Digest))
+        || !in_bounds(header_.strings_off, header_.strings_size, 1)
+        || !in_bounds(header_.filter_off, header_.filter_blocks,
+                      BloomFilter::BLOCK_SIZE)) {
+        throw runtime_error("image: section out of bounds");
+    }
+    ninodes_ = header_.ninodes;
+    inodes_ = reinterpret_cast<const InodeRecord *>(base + header_.inodes_off);
+    dirents_ = reinterpret_cast<const DirentRecord *>(base + header_.dirents_off);
+    digests_ = reinterpret_cast<const Digest *>(base + header_.digests_off);
+    strings_ = base + header_.strings_off;
+    validate();
+    if (header_.filter_blocks != 0) {
+        filter_.reset(new BloomFilter(base + header_.filter_off,
+                                      header_.filter_blocks, header_.ndirents));
+    }
+}
+
+// Check every record against the sections it refers to, so that a
+// corrupt image fails here instead of while it is being served.
+void Image::validate() const
+{
+    const auto& h = header_;
+    auto text_ok = [&](uint64_t off, uint64_t len) {
+        return off < h.strings_size && len < h.strings_size - off
+            && strings_[off + len] == '\0';
+    };
+    for (uint64_t k = 0; k < h.ninodes; ++k) {
+        const auto& i = inodes_[k];
+        bool ok = true;
+        if (S_ISDIR(i.mode)) {
+            ok = i.off <= h.ndirents && i.len <= h.ndirents - i.off;
+        } else if (S_ISLNK(i.mode)) {
+            ok = text_ok(i.off, i.len);
+        }
+        // The tree object's own record has no digest.
+        bool tree_self = (h.flags & IMAGE_TREE) && k == 0;
+        if ((S_ISDIR(i.mode) || S_ISREG(i.mode)) && !tree_self) {
+            ok = ok && i.digest < h.ndigests;
+        }
+        if (!ok) {
+            throw runtime_error("image: record out of bounds");
+        }
+    }
+    for (uint64_t k = 0; k < h.ndirents; ++k) {
+        const auto& d = dirents_[k];
+        if (d.ino < h.root_ino || d.ino - h.root_ino >= h.ninodes
+            || !text_ok(d.name_off, d.name_len)) {
+            throw runtime_error("image: record out of bounds");
+        }
+    }
+}
+
+// Reserve a slot for the index of each of n inodes.
+void Image::reserve_indexes(size_t n)
+{
+    void *p = mmap(nullptr, n * sizeof(*indexes_), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        throw system_error(errno, generic_category(), "mmap");
+    }
+    indexes_ = static_cast<atomic<const DirIndex *> *>(p);
+    nindexes_ = n;
+}
+
+// Index the listing of dir, unless another lookup got there first.
+const DirIndex* Image::index_dir(ino_t dir, const DirentTable& table) const
+{
+    auto& slot = indexes_[dir - root()];
+    lock_guard<mutex> g {index_mutex_};
+    if (auto index = slot.load(memory_order_relaxed)) {
+        return index;
+    }
+    built_.emplace_back(new DirIndex {table.size(),
+        [this, &table](size_t k) { return name(table[k]); }});
+    slot.store(built_.back().get(), memory_order_release);
+    return built_.back().get();
+}
+
+const DirentRecord* Image::find(ino_t dir, const DirentTable& table,
+                                string_view name) const
+{
+    if (table.size() >= DIR_INDEX_MIN && dir - root() < nindexes_) {
+        auto index = indexes_[dir - root()].load(memory_order_acquire);
+        if (index == nullptr) {
+            index = index_dir(dir, table);
+        }
+        size_t k = index->find(name,
+            [this, &table](size_t k) { return this->name(table[k]); });
+        return k == SIZE_MAX ? nullptr : &table[k];
+    }
+    auto it = lower_bound(table.begin(), table.end(), name,
+        [this](const DirentRecord& d, string_view s) {
+            return this->name(d) < s;
+        });
+    return it != table.end() && this->name(*it) == name ? it : nullptr;
+}
+
+bool Image::probe(const string& path)
+{
+    char magic[sizeof(IMAGE_MAGIC)] = {};
+    ifstream i {path, ios::binary};
+    i.read(magic, sizeof(magic));
+    return i && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+uint64_t Image::Region::append(const void *p, size_t n)
+{
+    if (n > cap - size) {
+        return UINT64_MAX;
+    }
+    memcpy(base + size, p, n);
+    size += n;
+    return size - n;
+}
+
+static bool read_file(const string& path, string& data)
+{
+    ifstream i {path, ios::binary};
+    if (!i) {
+        return false;
+    }
+    ostringstream os;
+    os << i.rdbuf();
+    data = os.str();
+    return true;
+}
+
+int Image::fault(ino_t ino) const
+{
+    if (!lazy_ || !valid(ino)) {
+        return 0;
+    }
+    const auto& i = inode(ino);
+    if (!(__atomic_load_n(&i.flags, __ATOMIC_ACQUIRE) & INODE_LAZY)) {
+        return 0;
+    }
+
+    // Only one fault per directory reads its tree; the others wait for
+    // it, and try themselves if it failed.
+    {
+        unique_lock<mutex> g {faults_mutex_};
+        faults_cv_.wait(g, [&] { return !faults_.count(ino); });
+        if (!(i.flags & INODE_LAZY)) {
+            return 0;
+        }
+        faults_.insert(ino);
+    }
+    // The pool read, the fetch and the hash are done without holding
+    // lazy_mutex_, so a slow fetch does not hold up other directories.
+    unique_ptr<Image> tree;
+    int err = read_tree(i, tree);
+    if (err == 0) {
+        lock_guard<mutex> g {lazy_mutex_};
+        err = add_tree(i, *tree);
+    }
+    {
+        lock_guard<mutex> g {faults_mutex_};
+        faults_.erase(ino);
+    }
+    faults_cv_.notify_all();
+    return err;
+}
+
+// Read the tree object of dir from the pool, fetching it if it is not
+// there, and check it. Every failure is EIO: a missing directory must
+// not read as a missing entry.
+int Image::read_tree(const InodeRecord& dir, unique_ptr<Image>& tree) const
+{
+    const Digest& digest = digests_[dir.digest];
+    string key = digest_to_hex(digest);
+    string path = pool_ + "/" + key;
+    string data;
+    if (!read_file(path, data)
+        && !(fetch_ && fetch_(key) && read_file(path, data))) {
+        return EIO;
+    }
+    if (digest_sha256(data) != digest) {
+        return EIO;
+    }
+    // Not indexed: only its records are copied into this image.
+    tree.reset(new Image);
+    tree->data_ = move(data);
+    try {
+        tree->attach(tree->data_.data(), tree->data_.size());
+    } catch (const exception&) {
+        return EIO;
+    }
+    const auto& th = tree->header_;
+    const auto& self = tree->inodes_[0];
+    if (!(th.flags & IMAGE_TREE) || th.root_ino != 0 || !S_ISDIR(self.mode)
+        || self.off != 0 || self.len != th.ninodes - 1
+        || self.len > th.ndirents) {
+        return EIO;
+    }
+    return 0;
+}
+
+// Copy the records of tree into the regions and publish them as the
+// listing of dir. Called with lazy_mutex_ held (or before the image is
+// shared).
+int Image::add_tree(const InodeRecord& dir, const Image& tree,
+                    mode_t *mode) const
+{
+    const auto& th = tree.header_;
+    const auto& self = tree.inodes_[0];
+    auto& inodes = regions_[0];
+    auto& dirents = regions_[1];
+    auto& digests = regions_[2];
+    auto& strings = regions_[3];
+    const size_t saved[] = {inodes.size, dirents.size, digests.size, strings.size};
+    auto add_string = [&strings](const char *s, size_t n) {
+        uint64_t off = strings.append(s, n);
+        return off != UINT64_MAX && strings.append("", 1) != UINT64_MAX
+            ? off : UINT64_MAX;
+    };
+
+    const uint64_t base = inodes.size / sizeof(InodeRecord);
+    const uint64_t first = dirents.size / sizeof(DirentRecord);
+    const uint64_t n = self.len;
+    int err = 0;
+    for (uint64_t k = 0; k < n && !err; ++k) {
+        DirentRecord d = tree.dirents_[k];
+        InodeRecord c = tree.inodes_[k + 1];
+        bool lazy = S_ISDIR(c.mode);
+        if (d.ino != k + 1 || d.name_off + d.name_len >= th.strings_size
+            || c.flags != (lazy ? INODE_LAZY : 0)) {
+            err = EIO;
+            break;
+        }
+        if (S_ISDIR(c.mode) || S_ISREG(c.mode)) {
+            if (c.digest >= th.ndigests) {
+                err = EIO;
+                break;
+            }
+            uint64_t off = digests.append(&tree.digests_[c.digest],
+                                          sizeof(Digest));
+            c.digest = off == UINT64_MAX ? off : off / sizeof(Digest);
+            c.off = c.len = 0;
+        } else if (S_ISLNK(c.mode)) {
+            if (c.off + c.len >= th.strings_size) {
+                err = EIO;
+                break;
+            }
+            c.off = add_string(tree.strings_ + c.off, c.len);
+        } else {
+            c.off = c.len = c.digest = 0;
+        }
+        d.name_off = add_string(tree.strings_ + d.name_off, d.name_len);
+        d.ino = root() + base + k;
+        if (c.off == UINT64_MAX || c.digest == UINT64_MAX
+            || d.name_off == UINT64_MAX
+            || inodes.append(&c, sizeof(c)) == UINT64_MAX
+            || dirents.append(&d, sizeof(d)) == UINT64_MAX) {
+            err = ENOMEM;
+        }
+    }
+    if (err) {
+        inodes.size = saved[0];
+        dirents.size = saved[1];
+        digests.size = saved[2];
+        strings.size = saved[3];
+        return err;
+    }
+
+    // Publish the children before the listing that refers to them.
+    ninodes_.store(base + n, memory_order_release);
+    auto& w = const_cast<InodeRecord&>(dir);
+    w.off = first;
+    w.len = n;
+    if (mode != nullptr) {
+        *mode = self.mode;
+    }
+    __atomic_store_n(&w.flags, 0u, __ATOMIC_RELEASE);
+    return 0;
+}
+
+ino_t Image::root() const
+{
+    return header_.root_ino;
+}
+
+ino_t Image::next_ino() const
+{
+    return header_.root_ino + ninodes_.load(memory_order_acquire);
+}
+
+bool Image::valid(ino_t ino) const
+{
+    return ino >= root() && ino < next_ino();
+}
+
+const InodeRecord& Image::inode(ino_t ino) const
+{
+    assert(valid(ino));
+    return inodes_[ino - root()];
+}
+
+string_view Image::text(uint64_t off, uint64_t len) const
+{
+    assert(off + len < header_.strings_size);
+    return string_view(strings_ + off, len);
+}
+
+mode_t Image::mode(ino_t ino) const
+{
+    return inode(ino).mode;
+}
+
+size_t Image::size(ino_t ino) const
+{
+    return inode(ino).size;
+}
+
+bool Image::is_dir(ino_t ino) const
+{
+    return S_ISDIR(mode(ino));
+}
+
+bool Image::is_lnk(ino_t ino) const
+{
+    return S_ISLNK(mode(ino));
+}
+
+bool Image::is_reg(ino_t ino) const
+{
+    return S_ISREG(mode(ino));
+}
+
+const Digest& Image::gethash(ino_t ino) const
+{
+    const auto& i = inode(ino);
+    assert((S_ISREG(i.mode) || S_ISDIR(i.mode))
+           && i.digest < header_.ndigests);
+    return digests_[i.digest];
+}
+
+string_view Image::readlink(ino_t ino) const
+{
+    const auto& i = inode(ino);
+    assert(S_ISLNK(i.mode));
+    return text(i.off, i.len);
+}
+
+DirentTable Image::dirents(ino_t ino) const
+{
+    const auto& i = inode(ino);
+    assert(S_ISDIR(i.mode));
+    if (fault(ino) != 0) {
+        return DirentTable(nullptr, 0);
+    }
+    assert(i.off + i.len <= header_.ndirents);
+    return DirentTable(dirents_ + i.off, i.len);
+}
+
+string_view Image::name(const DirentRecord& d) const
+{
+    return text(d.name_off, d.name_len);
+}
+
+ino_t Image::lookup(ino_t parent, string_view path) const
+{
+    while (!path.empty()) {
+        if (!valid(parent) || !is_dir(parent)) {
+            return 0;
+        }
+        auto step = pathsep(path);
+        if (filter_ && !filter_->may_contain(parent, step)) {
+            return 0;
+        }
+        auto d = find(parent, dirents(parent), step);
+        if (d == nullptr) {
+            return 0;
+        }
+        parent = d->ino;
+    }
+    return parent;
+}
+
+const BloomFilter* Image::filter() const
+{
+    return filter_.get();
+}
+
+namespace {
+
+class ImageWriter {
+  public:
+    vector<InodeRecord> inodes;
+    vector<DirentRecord> dirents;
+
+    uint64_t add_string(string_view s)
+    {
+        return strings_.add(s);
+    }
+
+    uint64_t add_digest(const Digest& d)
+    {
+        auto [it, added] = digest_index_.emplace(d, digests_.size());
+        if (added) {
+            digests_.push_back(d);
+        }
+        return it->second;
+    }
+
+    void write(ostream& os, uint64_t root, uint32_t flags,
+               const BloomFilter *filter = nullptr) const;
+
+  private:
+    vector<Digest> digests_;
+    unordered_map<Digest, uint64_t, DigestHash> digest_index_;
+    NameTable strings_;
+};
+
+void write_padding(ostream& os, uint64_t& pos, uint64_t to)
+{
+    static const char zeros[64] = {};
+    os.write(zeros, to - pos);
+    pos = to;
+}
+
+void ImageWriter::write(ostream& os, uint64_t root, uint32_t flags,
+                        const BloomFilter *filter) const
+{
+    ImageHeader h {};
+    memcpy(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    h.version = IMAGE_VERSION;
+    h.flags = flags;
+    h.root_ino = root;
+    h.ninodes = inodes.size();
+    h.ndirents = dirents.size();
+    h.ndigests = digests_.size();
+    h.strings_size = strings_.size();
+    h.inodes_off = align8(sizeof(h));
+    h.dirents_off = align8(h.inodes_off + inodes.size() * sizeof(InodeRecord));
+    h.digests_off = align8(h.dirents_off + dirents.size() * sizeof(DirentRecord));
+    h.strings_off = align8(h.digests_off + digests_.size() * sizeof(Digest));
+    if (filter != nullptr) {
+        h.filter_off = align64(h.strings_off + strings_.size());
+        h.filter_blocks = filter->blocks();
+    }
+
+    uint64_t pos = 0;
+    os.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    pos += sizeof(h);
+    write_padding(os, pos, h.inodes_off);
+    os.write(reinterpret_cast<const char *>(inodes.data()),
+             inodes.size() * sizeof(InodeRecord));
+    pos += inodes.size() * sizeof(InodeRecord);
+    write_padding(os, pos, h.dirents_off);
+    os.write(reinterpret_cast<const char *>(dirents.data()),
+             dirents.size() * sizeof(DirentRecord));
+    pos += dirents.size() * sizeof(DirentRecord);
+    write_padding(os, pos, h.digests_off);
+    os.write(reinterpret_cast<const char *>(digests_.data()),
+             digests_.size() * sizeof(Digest));
+    pos += digests_.size() * sizeof(Digest);
+    write_padding(os, pos, h.strings_off);
+    os.write(strings_.data(), strings_.size());
+    pos += strings_.size();
+    if (filter != nullptr) {
+        write_padding(os, pos, h.filter_off);
+        os.write(static_cast<const char *>(filter->data()), filter->memory());
+    }
+}
+
+}
+
+typedef function<void(ino_t, const Digest&, const string&)> TreeVisitor;
+
+// Serialize directory ino as a tree object and return its digest. The
+// visitor sees every directory below ino, children before parents.
+static Digest hash_tree(const FileSystem& fs, ino_t ino,
+                        const TreeVisitor& visit)
+{
+    auto dir = fs[ino];
+    ImageWriter w;
+    w.inodes.push_back(InodeRecord{dir.mode(), 0, dir.size(), 0,
+                                   dir.dirents().size(), 0});
+    for (const auto& e : dir.dirents()) {
+        auto child = fs[e.ino];
+        InodeRecord r {child.mode(), 0, child.size(), 0, 0, 0};
+        if (child.is_dir()) {
+            r.flags = INODE_LAZY;
+            r.digest = w.add_digest(hash_tree(fs, e.ino, visit));
+        } else if (child.is_reg()) {
+            r.digest = w.add_digest(child.gethash());
+        } else if (child.is_lnk()) {
+            r.len = child.readlink().size();
+            r.off = w.add_string(child.readlink());
+        }
+        DirentRecord d {};
+        d.name_len = e.name_len;
+        d.name_off = w.add_string(fs.name(e));
+        d.ino = w.inodes.size();
+        w.inodes.push_back(r);
+        w.dirents.push_back(d);
+    }
+
+    ostringstream os;
+    w.write(os, 0, IMAGE_TREE);
+    string data = os.str();
+    Digest digest = digest_sha256(data);
+    visit(ino, digest, data);
+    return digest;
+}
+
+void write_image(const FileSystem& fs, ostream& os)
+{
+    ImageWriter w;
+    size_t ndirents = 0;
+    for (ino_t ino = fs.root(); ino < fs.next_ino(); ++ino) {
+        auto inode = fs[ino];
+        if (inode.is_dir()) {
+            ndirents += inode.dirents().size();
+        }
+    }
+    BloomFilter filter {ndirents};
+    for (ino_t ino = fs.root(); ino < fs.next_ino(); ++ino) {
+        auto inode = fs[ino];
+        InodeRecord r {};
+        r.mode = inode.mode();
+        r.size = inode.size();
+        if (inode.is_dir()) {
+            r.off = w.dirents.size();
+            for (const auto& e : inode.dirents()) {
+                DirentRecord d {};
+                d.name_len = e.name_len;
+                d.name_off = w.add_string(fs.name(e));
+                d.ino = e.ino;
+                w.dirents.push_back(d);
+                filter.add(ino, fs.name(e));
+            }
+            r.len = w.dirents.size() - r.off;
+        } else if (inode.is_reg()) {
+            r.digest = w.add_digest(inode.gethash());
+        } else if (inode.is_lnk()) {
+            r.len = inode.readlink().size();
+            r.off = w.add_string(inode.readlink());
+        }
+        w.inodes.push_back(r);
+    }
+    hash_tree(fs, fs.root(),
+        [&w, &fs](ino_t ino, const Digest& digest, const string&) {
+            w.inodes[ino - fs.root()].digest = w.add_digest(digest);
+        });
+    w.write(os, fs.root(), 0, &filter);
+}
+
+Digest write_tree(const FileSystem& fs, const string& pool)
+{
+    // Objects are immutable and named by content: keep existing ones.
+    return hash_tree(fs, fs.root(),
+        [&pool](ino_t, const Digest& digest, const string& data) {
+            string path = pool + "/" + digest_to_hex(digest);
+            if (access(path.c_str(), F_OK) == 0) {
+                return;
+            }
+            string tmp = path + ".tmp";
+            ofstream o {tmp, ios::binary | ios::trunc};
+            o.write(data.data(), data.size());
+            o.close();
+            if (!o || rename(tmp.c_str(), path.c_str()) != 0) {
+                throw runtime_error("tree: failed to write " + path);
+            }
+        });
+}
+
+unique_ptr<Image> load_image(const string& path)
+{
+    if (Image::probe(path)) {
+        return make_unique<Image>(path);
+    }
+    FileSystem fs;
+    fs.load(path);
+    ostringstream os;
+    write_image(fs, os);
+    return Image::from_string(os.str());
+}
+
+}
@@ -0,0 +1,223 @@
+#ifndef INCLUDE_MERKLEFS_IMAGE_
+#define INCLUDE_MERKLEFS_IMAGE_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "bloom.hpp"
+#include "digest.hpp"
+#include "dirindex.hpp"
+
+namespace metadata {
+
+class FileSystem;
+
+/*
+ * Binary metadata image.
+ *
+ * The image is laid out so that it can be mmap()ed and used in place:
+ *
+ *   ImageHeader | InodeRecord[ninodes] | DirentRecord[ndirents]
+ *               | Digest[ndigests] | strings | filter
+ *
+ * All integers are in host byte order and every section starts on an
+ * 8-byte boundary; the filter starts on a 64-byte one. Inode records are indexed by (ino - root_ino). The
+ * dirents of a directory are stored contiguously and sorted by name.
+ * Content hashes are stored once each in the digest table. Names and
+ * symlink targets live in the string section, interned so that each
+ * distinct string appears once, and are NUL-terminated so they can be
+ * handed to libfuse without copying. The filter is the blocks of a
+ * BloomFilter of every (parent, name) pair, built when the image is
+ * written so that opening it is not O(ndirents).
+ *
+ * A tree object (IMAGE_TREE) is an image of a single directory: inode 0
+ * is the directory and inodes 1..n are its entries in name order. Child
+ * directories are INODE_LAZY and refer to their own tree object by
+ * digest, so a tree is named by the hash of its listing and a whole
+ * filesystem forms a Merkle tree that can be stored in the pool and
+ * loaded one directory at a time.
+ *
+ * Every directory record also carries the digest of the tree object
+ * it would be stored as, in flat images too, so two images can be
+ * compared without descending into identical subtrees.
+ */
+
+constexpr char IMAGE_MAGIC[8] = {'M', 'E', 'R', 'K', 'L', 'E', 'F', 'S'};
+constexpr uint32_t IMAGE_VERSION = 5;
+
+// ImageHeader::flags
+constexpr uint32_t IMAGE_TREE = 1;
+
+// InodeRecord::flags: a directory whose listing is not loaded yet.
+constexpr uint32_t INODE_LAZY = 1;
+
+// Directories with at least this many entries get a hash index on
+// their first lookup; smaller ones are binary searched.
+constexpr size_t DIR_INDEX_MIN = 32;
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t root_ino;
+    uint64_t ninodes;
+    uint64_t ndirents;
+    uint64_t ndigests;
+    uint64_t strings_size;
+    uint64_t inodes_off;
+    uint64_t dirents_off;
+    uint64_t digests_off;
+    uint64_t strings_off;
+    uint64_t filter_off;
+    uint64_t filter_blocks; // 0 for tree objects
+};
+
+struct InodeRecord {
+    uint32_t mode;
+    uint32_t flags;
+    uint64_t size;
+    uint64_t off;   // DIR: index of first dirent, LNK: string offset
+    uint64_t len;   // DIR: number of dirents, LNK: string length
+    uint64_t digest;    // DIR: index of tree digest, REG: index of
+                        // content digest (unused for the tree itself)
+};
+
+struct DirentRecord {
+    uint64_t name_off;
+    uint32_t name_len;
+    uint32_t reserved;
+    uint64_t ino;
+};
+
+class DirentTable {
+  public:
+    DirentTable(const DirentRecord *begin, size_t size)
+        : begin_(begin), size_(size) {}
+    const DirentRecord* begin() const { return begin_; }
+    const DirentRecord* end() const { return begin_ + size_; }
+    const DirentRecord& operator[](size_t i) const { return begin_[i]; }
+    size_t size() const { return size_; }
+
+  private:
+    const DirentRecord *begin_;
+    size_t size_;
+};
+
+class Image {
+  public:
+    typedef std::function<bool(const std::string& key)> Fetch;
+
+    // Map an image file read-only.
+    explicit Image(const std::string& path);
+    ~Image();
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
+    // Use an image that was serialized into memory.
+    static std::unique_ptr<Image> from_string(std::string data);
+    // Serve the Merkle tree rooted at root, loading tree objects from
+    // pool (or through fetch) when a directory is first accessed.
+    static std::unique_ptr<Image> open_tree(const Digest& root,
+        const std::string& pool, Fetch fetch);
+    static bool probe(const std::string& path);
+
+    // Make sure the listing of ino is loaded; returns 0 or an errno.
+    int fault(ino_t ino) const;
+
+    ino_t root() const;
+    ino_t next_ino() const;
+    bool valid(ino_t ino) const;
+    mode_t mode(ino_t ino) const;
+    size_t size(ino_t ino) const;
+    bool is_dir(ino_t ino) const;
+    bool is_lnk(ino_t ino) const;
+    bool is_reg(ino_t ino) const;
+    // The content digest of a file or the tree digest of a directory.
+    const Digest& gethash(ino_t ino) const;
+    std::string_view readlink(ino_t ino) const;
+    DirentTable dirents(ino_t ino) const;
+    std::string_view name(const DirentRecord& d) const;
+    ino_t lookup(ino_t parent, std::string_view path) const;
+    // The filter of (parent, name) pairs that exist, or nullptr for tree
+    // images, which are loaded a directory at a time.
+    const BloomFilter* filter() const;
+
+  private:
+    // Append-only storage for lazily loaded sections. Address space is
+    // reserved up front so published records never move.
+    struct Region {
+        char *base = nullptr;
+        size_t size = 0;
+        size_t cap = 0;
+        uint64_t append(const void *p, size_t n);
+    };
+
+    Image() = default;
+    void attach(const char *base, size_t len);
+    void validate() const;
+    void reserve_indexes(size_t n);
+    const DirIndex* index_dir(ino_t dir, const DirentTable& table) const;
+    const DirentRecord* find(ino_t dir, const DirentTable& table,
+                             std::string_view name) const;
+    const InodeRecord& inode(ino_t ino) const;
+    std::string_view text(uint64_t off, uint64_t len) const;
+    int read_tree(const InodeRecord& dir, std::unique_ptr<Image>& tree) const;
+    int add_tree(const InodeRecord& dir, const Image& tree,
+                 mode_t *mode = nullptr) const;
+
+    const char *base_ = nullptr;
+    size_t len_ = 0;
+    bool mapped_ = false;
+    std::string data_;
+    ImageHeader header_ {};
+    mutable std::atomic<uint64_t> ninodes_ {0};
+    const InodeRecord *inodes_ = nullptr;
+    const DirentRecord *dirents_ = nullptr;
+    const Digest *digests_ = nullptr;
+    const char *strings_ = nullptr;
+
+    bool lazy_ = false;
+    std::string pool_;
+    Fetch fetch_;
+    // Held while appending to the regions.
+    mutable std::mutex lazy_mutex_;
+    mutable Region regions_[4];
+    // Directories whose tree objects are being read, by ino.
+    mutable std::mutex faults_mutex_;
+    mutable std::condition_variable faults_cv_;
+    mutable std::unordered_set<ino_t> faults_;
+
+    // The index of each large directory by ino - root(), built on its
+    // first lookup. The table is reserved address space, so pages are
+    // only committed where directories are indexed.
+    std::atomic<const DirIndex *> *indexes_ = nullptr;
+    size_t nindexes_ = 0;
+    // Held while building an index; owns the built ones.
+    mutable std::mutex index_mutex_;
+    mutable std::vector<std::unique_ptr<DirIndex>> built_;
+    std::unique_ptr<BloomFilter> filter_;
+};
+
+void write_image(const FileSystem& fs, std::ostream& os);
+
+// Store every directory of fs as a tree object in pool, skipping
+// objects that already exist. Returns the digest of the root tree.
+Digest write_tree(const FileSystem& fs, const std::string& pool);
+
+// Load metadata from either a binary image or a JSON file.
+std::unique_ptr<Image> load_image(const std::string& path);
+
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "listing.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace metadata {
+
+void Listing::reserve(size_t entries)
+{
+    ends_.reserve(entries);
+}
+
+char* Listing::append(size_t len)
+{
+    auto pos = buf_.size();
+    buf_.resize(pos + len);
+    ends_.push_back(buf_.size());
+    return &buf_[pos];
+}
+
+Listing::Slice Listing::slice(uint64_t offset, size_t size) const
+{
+    Slice s;
+    s.first = min<uint64_t>(offset, ends_.size());
+    s.begin = s.first ? ends_[s.first - 1] : 0;
+    // The first entry that ends past the reply is left out.
+    auto last = upper_bound(ends_.begin() + s.first, ends_.end(),
+                            s.begin + size);
+    s.last = last - ends_.begin();
+    s.end = s.last > s.first ? ends_[s.last - 1] : s.begin;
+    return s;
+}
+
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDE_MERKLEFS_LISTING_
+#define INCLUDE_MERKLEFS_LISTING_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace metadata {
+
+/*
+ * A directory encoded as readdir replies.
+ *
+ * The caller encodes the entries in order, each with the offset of the
+ * one after it, so the offset a reply resumes at is an entry index.
+ * Entry k ends at ends_[k] in the buffer, so any reply is a slice of
+ * whole entries and costs a binary search and a copy.
+ */
+class Listing {
+  public:
+    // Entries [first, last), which are bytes [begin, end) of data().
+    struct Slice {
+        size_t first = 0;
+        size_t last = 0;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void reserve(size_t entries);
+    // Add an entry of len bytes; returns where to encode it, valid until
+    // the next append().
+    char* append(size_t len);
+    // The entries from index offset on that fit in size bytes. Offsets
+    // past the end give an empty slice at the end.
+    Slice slice(uint64_t offset, size_t size) const;
+
+    const char* data() const { return buf_.data(); }
+    // Number of entries.
+    size_t size() const { return ends_.size(); }
+    size_t bytes() const { return buf_.size(); }
+
+  private:
+    std::string buf_;
+    std::vector<size_t> ends_;
+};
+
+}
+
+#endif
@@ -1,9 +1,20 @@
 #include "metadata.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <ctime>
 #include <cassert>
-
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "path.hpp"
 
@@ -11,10 +22,24 @@ using namespace std;
 
 namespace metadata {
 
-FileSystem::FileSystem(ino_t root) : root_ino_(root), mnt_ts_(time(nullptr)) {
+FileSystem::FileSystem(ino_t root, bool huge_pages)
+    : arena_(new Arena(huge_pages)), root_ino_(root), mnt_ts_(time(nullptr)) {
     mknod(S_IFDIR | 0755); // create root directory
 };
 
+FileSystem& FileSystem::operator=(FileSystem&& o)
+{
+    // Everything that lives in our arena must go before the arena does.
+    cache_.reset();
+    table_.clear();
+    arena_ = move(o.arena_);
+    table_ = move(o.table_);
+    root_ino_ = o.root_ino_;
+    mnt_ts_ = o.mnt_ts_;
+    cache_ = move(o.cache_);
+    return *this;
+}
+
 int FileSystem::creat(const char *name, mode_t mode) {
     ino_t ino = mknod(S_IFREG | mode);
     return linkat(root_ino_, name, ino);
@@ -45,172 +70,852 @@ int FileSystem::link(const char *oldname, const char *name) {
 
 ino_t FileSystem::mknod(mode_t mode) {
     ino_t ino = next_ino();
-    inodes_.push_back(Inode{ino, mode});
+    table_.push(mode, 0, arena_.get());
+    return ino;
+}
+
+ino_t FileSystem::root() const { return root_ino_; }
+
+ino_t FileSystem::next_ino() const { return table_.size() + root_ino_; }
+
+size_t FileSystem::index(ino_t ino) const
+{
+    size_t i = ino - root_ino_;
+    assert(ino >= root_ino_ && i < table_.size());
+    return i;
+}
+
+Inode FileSystem::operator[](ino_t ino) const
+{
+    return Inode(*this, ino);
+}
+
+Dirents& FileSystem::dirents(ino_t ino)
+{
+    size_t i = index(ino);
+    assert(S_ISDIR(table_.modes[i]));
+    return table_.dirs[table_.payload[i]];
+}
+
+string_view FileSystem::name(const Dirent& d) const
+{
+    return table_.names.get(d.name_off, d.name_len);
+}
+
+const NameTable& FileSystem::names() const
+{
+    return table_.names;
+}
+
+uint32_t FileSystem::Table::push(mode_t mode, uint64_t size, Arena *arena)
+{
+    uint32_t p = 0;
+    if (S_ISDIR(mode)) {
+        p = dirs.size();
+        dirs.emplace_back(arena);
+    } else if (S_ISREG(mode)) {
+        p = digests.size();
+        digests.emplace_back();
+    } else if (S_ISLNK(mode)) {
+        p = links.size();
+        links.push_back(Link{0, 0});
+    }
+    modes.push_back(mode);
+    sizes.push_back(size);
+    payload.push_back(p);
+    return p;
+}
+
+void FileSystem::Table::clear()
+{
+    modes.clear();
+    sizes.clear();
+    payload.clear();
+    digests.clear();
+    links.clear();
+    dirs.clear();
+    names.clear();
+}
+
+Dirents::const_iterator FileSystem::find(const Dirents& dirents,
+                                         string_view name) const
+{
+    return lower_bound(dirents.begin(), dirents.end(), name,
+        [this](const Dirent& d, string_view s) {
+            return this->name(d) < s;
+        });
+}
+
+Dirents::iterator FileSystem::find(Dirents& dirents, string_view name)
+{
+    const auto& cdirents = dirents;
+    return dirents.begin() + (as_const(*this).find(cdirents, name)
+                              - dirents.cbegin());
+}
+
+void FileSystem::sort_dirents(Dirents& dirents)
+{
+    auto less = [this](const Dirent& a, const Dirent& b) {
+        return name(a) < name(b);
+    };
+    if (!is_sorted(dirents.begin(), dirents.end(), less)) {
+        sort(dirents.begin(), dirents.end(), less);
+    }
+}
+
+// True if every entry refers to one of the n inodes from root on.
+static bool dirents_in_range(const Dirents& dirents, ino_t root, size_t n)
+{
+    for (const auto& d : dirents) {
+        if (d.ino < root || d.ino - root >= n) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FileSystem::sort_dirents()
+{
+    for (auto& d : table_.dirs) {
+        sort_dirents(d);
+    }
+}
+
+ino_t FileSystem::lookup(ino_t parent, string_view path) const
+{
+    // A single name costs one binary search; only deeper paths are
+    // worth caching. Misses are not cached, since they are cheap to
+    // repeat and would have to be dropped whenever a name is added.
+    bool cached = cache_
+        && path.find('/', path.find_first_not_of('/')) != string_view::npos;
+    if (cached) {
+        if (ino_t ino = cache_->get(parent, path)) {
+            return ino;
+        }
+    }
+    ino_t ino = walk(parent, path);
+    if (cached && ino != 0) {
+        cache_->put(parent, path, ino);
+    }
     return ino;
 }
 
-ino_t FileSystem::next_ino() { return inodes_.size() + root_ino_; }
+void FileSystem::cache_paths(size_t capacity)
+{
+    cache_.reset(capacity ? new PathCache(capacity) : nullptr);
+}
 
-Inode& FileSystem::operator[](ino_t ino)
+const PathCache* FileSystem::path_cache() const
 {
-    ino_t i = ino - root_ino_;
-    assert(ino >= root_ino_ && i < inodes_.size());
-    return inodes_[i];
+    return cache_.get();
 }
 
-ino_t FileSystem::lookup(ino_t parent, const char *name)
+void FileSystem::forget_paths()
 {
-    while (name != nullptr && *name) {
-        Inode& dir = (*this)[parent];
+    if (cache_) {
+        cache_->clear();
+    }
+}
+
+ino_t FileSystem::walk(ino_t parent, string_view path) const
+{
+    while (!path.empty()) {
+        if (parent == 0 || parent < root_ino_ || parent >= next_ino()) {
+            return 0;
+        }
+        auto dir = (*this)[parent];
         if (!dir.is_dir()) {
             return 0;
         }
-        auto step = pathsep(name);
-        parent = dir.dirents()[step];
+        auto step = pathsep(path);
+        const auto& dirents = dir.dirents();
+        auto it = find(dirents, step);
+        if (it == dirents.end() || name(*it) != step) {
+            return 0;
+        }
+        parent = it->ino;
     }
     return parent;
 }
 
-int FileSystem::linkat(ino_t parent, const char *name, ino_t target)
+int FileSystem::linkat(ino_t parent, string_view path, ino_t target)
 {
-    while (name != nullptr && *name) {
+    while (!path.empty()) {
         if (parent == 0) {
             return -ENOENT;
         }
-        Inode& dir = (*this)[parent];
-        if (!dir.is_dir()) {
+        if (!(*this)[parent].is_dir()) {
             return -ENOTDIR;
         }
-        auto step = pathsep(name);
-        if (name == nullptr) {
-            dir.dirents()[step] = target;
+        auto& dirents = this->dirents(parent);
+        auto step = pathsep(path);
+        auto it = find(dirents, step);
+        bool found = it != dirents.end() && name(*it) == step;
+        if (path.empty()) {
+            if (found) {
+                it->ino = target;
+                forget_paths();
+            } else {
+                Dirent d {table_.names.add(step), uint32_t(step.size()),
+                          target};
+                dirents.insert(it, d);
+            }
         } else {
-            parent = dir.dirents()[step];
+            parent = found ? it->ino : 0;
         }
     }
     return 0;
 }
 
-int FileSystem::unlinkat(ino_t parent, const char *name)
+int FileSystem::unlinkat(ino_t parent, string_view path)
 {
-    while (name != nullptr && *name) {
+    while (!path.empty()) {
         if (parent == 0) {
             return -ENOENT;
         }
-        Inode& dir = (*this)[parent];
-        if (!dir.is_dir()) {
+        if (!(*this)[parent].is_dir()) {
             return -ENOTDIR;
         }
-        auto step = pathsep(name);
-        if (name == nullptr) {
-            if (dir.dirents().erase(step) == 0) {
+        auto& dirents = this->dirents(parent);
+        auto step = pathsep(path);
+        auto it = find(dirents, step);
+        bool found = it != dirents.end() && name(*it) == step;
+        if (path.empty()) {
+            if (!found) {
                 return -ENOENT;
             }
+            dirents.erase(it);
+            forget_paths();
         } else {
-            parent = dir.dirents()[step];
+            parent = found ? it->ino : 0;
         }
     }
     return 0;
 }
 
-Inode::Inode() {}
+Inode::Inode(const FileSystem& fs, ino_t ino) : fs_(&fs), i_(fs.index(ino)) {}
 
-Inode::Inode(ino_t ino, mode_t mode) : ino_(ino), mode_(mode)
+uint32_t Inode::payload() const
 {
-    if (is_dir()) {
-        payload_ = Dirents{};
-    }
+    return fs_->table_.payload[i_];
 }
 
 bool Inode::is_reg() const
 {
-    return S_ISREG(mode_);
+    return S_ISREG(mode());
 }
 
 bool Inode::is_dir() const
 {
-    return S_ISDIR(mode_);
+    return S_ISDIR(mode());
 }
 
 bool Inode::is_lnk() const
 {
-    return S_ISLNK(mode_);
+    return S_ISLNK(mode());
 }
 
 ino_t Inode::ino() const
 {
-    return ino_;
+    return fs_->root_ino_ + i_;
 }
 
 mode_t Inode::mode() const
 {
-    return mode_;
+    return fs_->table_.modes[i_];
 }
 
 size_t Inode::size() const
 {
-    return size_;
-}
-
-Dirents& Inode::dirents()
-{
-    return get<Dirents>(payload_);
+    return fs_->table_.sizes[i_];
 }
 
 const Dirents& Inode::dirents() const
 {
-    return get<Dirents>(payload_);
+    assert(is_dir());
+    return fs_->table_.dirs[payload()];
 }
 
-const string& Inode::readlink() const
+string_view Inode::readlink() const
 {
-    return get<string>(payload_);
+    assert(is_lnk());
+    const auto& l = fs_->table_.links[payload()];
+    return fs_->table_.names.get(l.off, l.len);
 }
 
-const string& Inode::gethash() const
+const Digest& Inode::gethash() const
 {
-    return get<string>(payload_);
+    assert(is_reg());
+    return fs_->table_.digests[payload()];
 }
 
 using nlohmann::json;
 
 void to_json(json& j, const FileSystem& fs)
 {
-    j = fs.inodes_;
+    j = json::array();
+    for (ino_t ino = fs.root(); ino < fs.next_ino(); ++ino) {
+        auto i = fs[ino];
+        json ji = {{"ino", ino}, {"mode", i.mode()}, {"size", i.size()}};
+        if (i.is_dir()) {
+            ji["dirents"] = json::object();
+            for (const auto& d : i.dirents()) {
+                ji["dirents"][string(fs.name(d))] = d.ino;
+            }
+        } else if (i.is_reg()) {
+            ji["value"] = digest_to_hex(i.gethash());
+        } else if (i.is_lnk()) {
+            ji["value"] = string(i.readlink());
+        }
+        j.push_back(ji);
+    }
 }
 
 void from_json(const json& j, FileSystem& fs)
 {
-    j.get_to(fs.inodes_);
-    fs.root_ino_ = fs.inodes_[0].ino();
+    auto& t = fs.table_;
+    t.clear();
+    fs.forget_paths();
+    for (const auto& ji : j) {
+        auto ino = ji.at("ino").get<ino_t>();
+        if (t.size() == 0) {
+            fs.root_ino_ = ino;
+        } else if (ino != fs.next_ino()) {
+            throw runtime_error("metadata: inodes are not numbered contiguously");
+        }
+        auto mode = ji.at("mode").get<mode_t>();
+        auto p = t.push(mode, ji.at("size").get<uint64_t>(), fs.arena_.get());
+        if (S_ISDIR(mode)) {
+            auto& dirents = t.dirs[p];
+            const auto& jd = ji.at("dirents");
+            dirents.reserve(jd.size());
+            for (const auto& el : jd.items()) {
+                const auto& name = el.key();
+                auto child = el.value().get<ino_t>();
+                // Old versions wrote missed lookups out as entries of 0.
+                if (child == 0) {
+                    continue;
+                }
+                dirents.push_back(Dirent{t.names.add(name),
+                    uint32_t(name.size()), child});
+            }
+            fs.sort_dirents(dirents);
+        } else if (S_ISREG(mode)) {
+            if (!digest_from_hex(ji.at("value").get<string>(), t.digests[p])) {
+                throw runtime_error("metadata: invalid hash");
+            }
+        } else if (S_ISLNK(mode)) {
+            auto value = ji.at("value").get<string>();
+            t.links[p] = FileSystem::Link{t.names.add(value),
+                                          uint32_t(value.size())};
+        }
+    }
+    for (const auto& dirents : t.dirs) {
+        if (!dirents_in_range(dirents, fs.root_ino_, t.size())) {
+            throw runtime_error("metadata: dirent refers to a missing inode");
+        }
+    }
+    t.names.shrink();
+}
+
+/*
+ * Streaming metadata loader.
+ *
+ * Appends inodes and dirents to a Table straight from SAX events
+ * instead of going through a json DOM, so peak memory stays close to
+ * the size of the resulting FileSystem. Accepts the same format as
+ * from_json(). Dirents are left unsorted.
+ */
+class FileSystem::Loader : public nlohmann::json_sax<json> {
+  public:
+    Loader(Table& table, Arena *arena) : t_(table), arena_(arena) {}
+
+    const std::string& error() const { return error_; }
+    ino_t first_ino() const { return first_; }
+
+    bool null() override { return scalar(); }
+    bool boolean(bool) override { return scalar(); }
+    bool number_float(number_float_t, const string_t&) override
+    {
+        return scalar();
+    }
+    bool binary(binary_t&) override { return scalar(); }
+
+    bool number_integer(number_integer_t val) override
+    {
+        if (val < 0 && !skip_ && (depth_ == 3 || field() != nullptr)) {
+            return fail("negative number");
+        }
+        return number_unsigned(val);
+    }
+
+    bool number_unsigned(number_unsigned_t val) override
+    {
+        if (skip_) {
+            return true;
+        }
+        if (depth_ == 3) {
+            // Old versions wrote missed lookups out as entries of 0.
+            if (val != 0) {
+                dirents_.push_back(Dirent{name_off_, name_len_, ino_t(val)});
+            }
+            return true;
+        }
+        if (depth_ != 2) {
+            return fail("unexpected number");
+        }
+        auto f = field();
+        if (f == nullptr) {
+            return true;
+        }
+        *f = val;
+        seen_ |= 1u << (f - fields_);
+        return true;
+    }
+
+    bool string(string_t& val) override
+    {
+        if (skip_ || (depth_ == 2 && key_ != "value")) {
+            return true;
+        }
+        if (depth_ != 2) {
+            return fail("unexpected string");
+        }
+        value_ = move(val);
+        seen_ |= VALUE;
+        return true;
+    }
+
+    bool key(string_t& val) override
+    {
+        if (skip_) {
+            return true;
+        }
+        if (depth_ == 3) {
+            name_off_ = t_.names.add(val);
+            name_len_ = val.size();
+        } else {
+            key_ = move(val);
+        }
+        return true;
+    }
+
+    bool start_object(size_t) override
+    {
+        ++depth_;
+        if (skip_) {
+            return true;
+        }
+        if (depth_ == 2) {
+            seen_ = 0;
+            dirents_.clear();
+            return true;
+        }
+        if (depth_ == 3 && key_ == "dirents") {
+            seen_ |= DIRENTS;
+            return true;
+        }
+        return depth_ > 2 ? skip() : fail("expected an array of inodes");
+    }
+
+    bool end_object() override
+    {
+        if (skip_ == depth_) {
+            skip_ = 0;
+        } else if (!skip_ && depth_ == 2 && !finish()) {
+            return false;
+        }
+        --depth_;
+        return true;
+    }
+
+    bool start_array(size_t) override
+    {
+        ++depth_;
+        if (skip_ || depth_ == 1) {
+            return true;
+        }
+        return depth_ > 2 ? skip() : fail("expected an inode object");
+    }
+
+    bool end_array() override
+    {
+        if (skip_ == depth_) {
+            skip_ = 0;
+        }
+        --depth_;
+        return true;
+    }
+
+    bool parse_error(size_t, const std::string&,
+                     const nlohmann::detail::exception& ex) override
+    {
+        return fail(ex.what());
+    }
+
+  private:
+    enum { INO = 1, MODE = 2, SIZE = 4, VALUE = 8, DIRENTS = 16 };
+
+    bool scalar()
+    {
+        return skip_ || depth_ == 2 || fail("unexpected value");
+    }
+
+    bool skip()
+    {
+        skip_ = depth_;
+        return true;
+    }
+
+    bool fail(const char *what)
+    {
+        error_ = what;
+        return false;
+    }
+
+    uint64_t *field()
+    {
+        if (key_ == "ino") return &fields_[0];
+        if (key_ == "mode") return &fields_[1];
+        if (key_ == "size") return &fields_[2];
+        return nullptr;
+    }
+
+    bool finish()
+    {
+        if ((seen_ & (INO | MODE | SIZE)) != (INO | MODE | SIZE)) {
+            return fail("inode is missing ino, mode or size");
+        }
+        mode_t mode = fields_[1];
+        Digest digest;
+        if (S_ISDIR(mode)) {
+            if (!(seen_ & DIRENTS)) {
+                return fail("directory is missing dirents");
+            }
+        } else if (!(seen_ & VALUE)) {
+            return fail("inode is missing value");
+        } else if (S_ISREG(mode) && !digest_from_hex(value_, digest)) {
+            return fail("invalid hash");
+        }
+        if (t_.size() == 0) {
+            first_ = fields_[0];
+        } else if (fields_[0] != first_ + t_.size()) {
+            return fail("inodes are not numbered contiguously");
+        }
+        auto p = t_.push(mode, fields_[2], arena_);
+        if (S_ISDIR(mode)) {
+            t_.dirs[p].assign(dirents_.begin(), dirents_.end());
+        } else if (S_ISREG(mode)) {
+            t_.digests[p] = digest;
+        } else if (S_ISLNK(mode)) {
+            t_.links[p] = Link{t_.names.add(value_),
+                               uint32_t(value_.size())};
+        }
+        return true;
+    }
+
+    Table& t_;
+    Arena *arena_;
+    std::string error_;
+    std::string key_;
+    std::string value_;
+    std::vector<Dirent> dirents_;
+    uint64_t fields_[3] = {};
+    unsigned seen_ = 0;
+    uint64_t name_off_ = 0;
+    uint32_t name_len_ = 0;
+    size_t depth_ = 0;
+    size_t skip_ = 0;
+    ino_t first_ = 0;
+};
+
+void FileSystem::load(istream& is)
+{
+    table_.clear();
+    forget_paths();
+    Loader loader {table_, arena_.get()};
+    if (!json::sax_parse(is, &loader)) {
+        throw runtime_error("metadata: " + loader.error());
+    }
+    if (table_.size() == 0) {
+        throw runtime_error("metadata: no inodes");
+    }
+    root_ino_ = loader.first_ino();
+    for (const auto& dirents : table_.dirs) {
+        if (!dirents_in_range(dirents, root_ino_, table_.size())) {
+            throw runtime_error("metadata: dirent refers to a missing inode");
+        }
+    }
+    sort_dirents();
+    table_.names.shrink();
+}
+
+/*
+ * Parallel metadata loader.
+ *
+ * A cheap scan that only tracks strings and nesting splits the inode
+ * array into chunks of whole elements. Chunks are parsed concurrently,
+ * each into a Table of its own. The chunk name tables are merged into
+ * the global one, then name offsets are rebased and dirents sorted,
+ * again in parallel, before the tables are appended in order.
+ */
+
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        ++p;
+    }
+    return p;
 }
 
-void to_json(json& j, const Inode& i)
+// Return the end of the JSON value starting at p, or nullptr.
+static const char *skip_value(const char *p, const char *end)
 {
-    j = json{{"ino", i.ino_}, {"mode", i.mode_}, {"size", i.size_}};
-    if (i.is_dir()) {
-        j["dirents"] = i.dirents();
-    } else if (i.is_reg()) {
-        j["value"] = i.gethash();
-    } else if (i.is_lnk()) {
-        j["value"] = i.readlink();
+    size_t depth = 0;
+    bool str = false;
+    for (; p < end; ++p) {
+        char c = *p;
+        if (str) {
+            if (c == '\\') {
+                ++p;
+            } else if (c == '"') {
+                str = false;
+                if (depth == 0) {
+                    return p + 1;
+                }
+            }
+        } else if (c == '"') {
+            str = true;
+        } else if (c == '{' || c == '[') {
+            ++depth;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0) {
+                return p;
+            }
+            if (--depth == 0) {
+                return p + 1;
+            }
+        } else if (depth == 0 && (c == ',' || c == ' ' || c == '\n'
+                                  || c == '\r' || c == '\t')) {
+            return p;
+        }
     }
+    return depth == 0 && !str ? p : nullptr;
 }
 
-void from_json(const json& j, Inode& i)
+// Iterates over "[" + [begin, end) + "]" without copying the chunk.
+class ChunkIterator {
+  public:
+    typedef forward_iterator_tag iterator_category;
+    typedef char value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const char *pointer;
+    typedef const char &reference;
+
+    ChunkIterator(const char *begin, ptrdiff_t len, ptrdiff_t pos)
+        : begin_(begin), len_(len), pos_(pos) {}
+
+    reference operator*() const
+    {
+        static const char open = '[', close = ']';
+        return pos_ < 0 ? open : pos_ < len_ ? begin_[pos_] : close;
+    }
+
+    ChunkIterator& operator++()
+    {
+        ++pos_;
+        return *this;
+    }
+
+    bool operator==(const ChunkIterator& o) const { return pos_ == o.pos_; }
+    bool operator!=(const ChunkIterator& o) const { return pos_ != o.pos_; }
+
+  private:
+    const char *begin_;
+    ptrdiff_t len_;
+    ptrdiff_t pos_;
+};
+
+struct FileSystem::LoadChunk {
+    const char *begin;
+    const char *end;
+    size_t first;
+    size_t count;
+    Table table;
+    ino_t first_ino;
+    string error;
+};
+
+void FileSystem::load(const string& path, unsigned threads)
 {
-    j.at("ino").get_to(i.ino_);
-    j.at("mode").get_to(i.mode_);
-    j.at("size").get_to(i.size_);
-    if (i.is_dir()) {
-        Dirents dirents;
-        j.at("dirents").get_to(dirents);
-        i.payload_ = dirents;
-    } else {
-        string value;
-        j.at("value").get_to(value);
-        i.payload_ = value;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw system_error(errno, generic_category(), path);
     }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        int err = st.st_size == 0 ? EINVAL : errno;
+        close(fd);
+        throw system_error(err, generic_category(), path);
+    }
+    size_t len = st.st_size;
+    void *map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw system_error(err, generic_category(), path);
+    }
+    madvise(map, len, MADV_SEQUENTIAL);
+    unique_ptr<void, function<void(void *)>> guard {map,
+        [len](void *p) { munmap(p, len); }};
+
+    if (threads == 0) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+
+    // Split the array into chunks of roughly equal size; a few chunks
+    // per thread keep the threads busy when inodes vary in size.
+    const char *data = static_cast<const char *>(map);
+    const char *end = data + len;
+    const size_t target = max<size_t>(len / (threads * 4), 1 << 20);
+    vector<LoadChunk> chunks;
+    size_t total = 0;
+    const char *p = skip_ws(data, end);
+    if (p == end || *p != '[') {
+        throw runtime_error("metadata: expected an array of inodes");
+    }
+    p = skip_ws(p + 1, end);
+    while (p < end && *p != ']') {
+        const char *q = skip_value(p, end);
+        if (q == nullptr || q == p) {
+            throw runtime_error("metadata: malformed inode array");
+        }
+        if (chunks.empty() || q - chunks.back().begin > ptrdiff_t(target)) {
+            chunks.push_back(LoadChunk{p, q, total, 0, {}, 0, {}});
+        }
+        chunks.back().end = q;
+        chunks.back().count++;
+        total++;
+        p = skip_ws(q, end);
+        if (p < end && *p == ',') {
+            p = skip_ws(p + 1, end);
+        } else if (p == end || *p != ']') {
+            throw runtime_error("metadata: malformed inode array");
+        }
+    }
+    if (total == 0) {
+        throw runtime_error("metadata: no inodes");
+    }
+
+    table_.clear();
+    forget_paths();
+
+    auto run = [&chunks, threads](function<void(LoadChunk&)> work) {
+        atomic<size_t> next {0};
+        vector<thread> pool;
+        auto worker = [&]() {
+            for (size_t k; (k = next++) < chunks.size();) {
+                work(chunks[k]);
+            }
+        };
+        for (unsigned t = 1; t < min<size_t>(threads, chunks.size()); ++t) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& t : pool) {
+            t.join();
+        }
+    };
+
+    run([this](LoadChunk& c) {
+        Loader loader {c.table, arena_.get()};
+        ptrdiff_t len = c.end - c.begin;
+        ChunkIterator first {c.begin, len, -1}, last {c.begin, len, len + 1};
+        if (!json::sax_parse(first, last, &loader)) {
+            c.error = loader.error();
+        }
+        c.first_ino = loader.first_ino();
+    });
+
+    for (const auto& c : chunks) {
+        if (!c.error.empty()) {
+            throw runtime_error("metadata: " + c.error);
+        }
+    }
+
+    // Intern the names of each chunk into the global table, recording
+    // where each of them went; chunk offsets are ascending.
+    vector<vector<pair<uint64_t, uint64_t>>> moved(chunks.size());
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        auto& names = chunks[k].table.names;
+        for (uint64_t off = 0; off < names.size();) {
+            string_view s {names.data() + off};
+            moved[k].emplace_back(off, table_.names.add(s));
+            off += s.size() + 1;
+        }
+        names.clear();
+    }
+
+    root_ino_ = chunks[0].first_ino;
+    const LoadChunk *first = chunks.data();
+    run([this, first, &moved, total](LoadChunk& c) {
+        const auto& m = moved[&c - first];
+        auto rebase = [&m](uint64_t off) {
+            return lower_bound(m.begin(), m.end(), make_pair(off, uint64_t(0)))
+                ->second;
+        };
+        if (c.first_ino != root_ino_ + c.first) {
+            c.error = "inodes are not numbered contiguously";
+            return;
+        }
+        for (auto& dirents : c.table.dirs) {
+            if (!dirents_in_range(dirents, root_ino_, total)) {
+                c.error = "dirent refers to a missing inode";
+                return;
+            }
+            for (auto& d : dirents) {
+                d.name_off = rebase(d.name_off);
+            }
+            sort_dirents(dirents);
+        }
+        for (auto& l : c.table.links) {
+            l.off = rebase(l.off);
+        }
+    });
+    for (const auto& c : chunks) {
+        if (!c.error.empty()) {
+            throw runtime_error("metadata: " + c.error);
+        }
+    }
+
+    // Append the chunk tables in order, rebasing payload indices. The
+    // dirent vectors are moved, so their storage stays in the arena.
+    auto& t = table_;
+    t.modes.reserve(total);
+    t.sizes.reserve(total);
+    t.payload.reserve(total);
+    for (auto& c : chunks) {
+        auto& ct = c.table;
+        uint32_t dbase = t.dirs.size();
+        uint32_t rbase = t.digests.size();
+        uint32_t lbase = t.links.size();
+        for (size_t k = 0; k < ct.size(); ++k) {
+            mode_t mode = ct.modes[k];
+            uint32_t p = ct.payload[k];
+            p += S_ISDIR(mode) ? dbase : S_ISREG(mode) ? rbase
+                 : S_ISLNK(mode) ? lbase : 0;
+            t.modes.push_back(mode);
+            t.sizes.push_back(ct.sizes[k]);
+            t.payload.push_back(p);
+        }
+        for (auto& dirents : ct.dirs) {
+            t.dirs.push_back(move(dirents));
+        }
+        t.digests.insert(t.digests.end(), ct.digests.begin(), ct.digests.end());
+        t.links.insert(t.links.end(), ct.links.begin(), ct.links.end());
+        ct.clear();
+    }
+    t.names.shrink();
 }
 
-}
\ No newline at end of file
+}
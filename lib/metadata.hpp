@@ -1,67 +1,134 @@
 #ifndef INCLUDE_MERKLEFS_METADATA_
 #define INCLUDE_MERKLEFS_METADATA_
 
+#include <cstdint>
 #include <ctime>
+#include <istream>
+#include <memory>
+#include <memory_resource>
 #include <string>
-#include <map>
-#include <variant>
+#include <string_view>
 #include <vector>
 
 #include <sys/types.h>
 
+#include "arena.hpp"
+#include "digest.hpp"
 #include "json.hpp"
+#include "names.hpp"
+#include "pathcache.hpp"
 
 namespace metadata {
 
 class Inode;
 
+// A directory entry. The name is interned in the name table of the owning
+// FileSystem; entries of a directory are kept sorted by name.
+struct Dirent {
+    uint64_t name_off;
+    uint32_t name_len;
+    ino_t ino;
+};
+
+// Dirent tables are allocated from the arena of the owning FileSystem.
+typedef std::pmr::vector<Dirent> Dirents;
+
 class FileSystem {
   public:
-    FileSystem(ino_t root = 1);
-    Inode& operator[](ino_t ino);
-    ino_t next_ino();
-    ino_t lookup(ino_t parent, const char *name);
+    FileSystem(ino_t root = 1, bool huge_pages = false);
+    FileSystem(FileSystem&&) = default;
+    FileSystem& operator=(FileSystem&& o);
+    void load(std::istream& is);
+    // Load a metadata file in parallel; threads == 0 uses all cores.
+    void load(const std::string& path, unsigned threads = 0);
+    Inode operator[](ino_t ino) const;
+    ino_t root() const;
+    ino_t next_ino() const;
+    // Never modifies the tree, so it is safe to call from any number of
+    // threads as long as nobody is building the filesystem meanwhile.
+    ino_t lookup(ino_t parent, std::string_view path) const;
+    // Cache the results of multi-component lookups; 0 disables it.
+    void cache_paths(size_t capacity);
+    const PathCache* path_cache() const;
+    std::string_view name(const Dirent& d) const;
+    const NameTable& names() const;
     int creat(const char* name, mode_t mode);
     int mkdir(const char* name, mode_t mode);
     int symlink(const char* target, const char *name);
     int link(const char* oldname, const char *name);
-    int unlinkat(ino_t parent, const char *name);
+    int unlinkat(ino_t parent, std::string_view path);
 
   private:
+    class Loader;
+    struct LoadChunk;
+
+    // A symlink target in the names buffer.
+    struct Link {
+        uint64_t off;
+        uint32_t len;
+    };
+
+    // The inode table, as dense arrays indexed by ino - root so that
+    // attribute lookups only touch mode and size. payload indexes
+    // digests for regular files, links for symlinks and dirs for
+    // directories; other inodes have none.
+    struct Table {
+        std::vector<mode_t> modes;
+        std::vector<uint64_t> sizes;
+        std::vector<uint32_t> payload;
+        std::vector<Digest> digests;
+        std::vector<Link> links;
+        std::vector<Dirents> dirs;
+        NameTable names;
+
+        size_t size() const { return modes.size(); }
+        // Add an inode with an empty payload; returns the payload index.
+        uint32_t push(mode_t mode, uint64_t size, Arena *arena);
+        void clear();
+    };
+
     ino_t mknod(mode_t mode);
-    int linkat(ino_t parent, const char *name, ino_t target);
-    std::vector<Inode> inodes_;
+    size_t index(ino_t ino) const;
+    Dirents& dirents(ino_t ino);
+    ino_t walk(ino_t parent, std::string_view path) const;
+    void forget_paths();
+    int linkat(ino_t parent, std::string_view path, ino_t target);
+    Dirents::iterator find(Dirents& dirents, std::string_view name);
+    Dirents::const_iterator find(const Dirents& dirents,
+                                 std::string_view name) const;
+    void sort_dirents(Dirents& dirents);
+    void sort_dirents();
+
+    // Declared first so that it outlives everything allocated from it.
+    std::unique_ptr<Arena> arena_;
+    Table table_;
     ino_t root_ino_;
     time_t mnt_ts_;
+    std::unique_ptr<PathCache> cache_;
+    friend class Inode;
     friend void to_json(nlohmann::json& j, const FileSystem& fs);
     friend void from_json(const nlohmann::json& j, FileSystem& fs);
 };
 
-typedef std::map<std::string, ino_t> Dirents;
-
+// A view of one inode of a FileSystem, valid as long as the FileSystem.
 class Inode {
   public:
-    Inode();
-    Inode(ino_t ino, mode_t mode);
     ino_t ino() const;
     mode_t mode() const;
     size_t size() const;
     bool is_dir() const;
     bool is_lnk() const;
     bool is_reg() const;
-    const std::string& gethash() const;
-    const std::string& readlink() const;
+    const Digest& gethash() const;
+    std::string_view readlink() const;
     const Dirents& dirents() const;
 
   private:
-    ino_t ino_ = 0;
-    mode_t mode_ = 0;
-    size_t size_ = 0;
-    std::variant<std::string, Dirents> payload_;
-    Dirents& dirents();
+    Inode(const FileSystem& fs, ino_t ino);
+    uint32_t payload() const;
+    const FileSystem *fs_;
+    size_t i_;
     friend FileSystem;
-    friend void to_json(nlohmann::json& j, const Inode& fs);
-    friend void from_json(const nlohmann::json& j, Inode& fs);
 };
 
 }
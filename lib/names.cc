@@ -0,0 +1,68 @@
+#include "names.hpp"
+
+#include <functional>
+
+using namespace std;
+
+namespace metadata {
+
+constexpr size_t MIN_SLOTS = 1024;
+
+uint64_t NameTable::add(string_view s)
+{
+    // Keep the index at most three quarters full.
+    if ((count_ + 1) * 4 > slots_.size() * 3) {
+        grow();
+    }
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash<string_view>()(s) & mask;; i = (i + 1) & mask) {
+        uint64_t slot = slots_[i];
+        if (slot == 0) {
+            uint64_t off = buf_.size();
+            buf_.append(s);
+            buf_.push_back('\0');
+            slots_[i] = off + 1;
+            ++count_;
+            return off;
+        }
+        uint64_t off = slot - 1;
+        if (buf_.compare(off, s.size(), s) == 0 && buf_[off + s.size()] == '\0') {
+            return off;
+        }
+    }
+}
+
+void NameTable::grow()
+{
+    // Rebuilt from the buffer, so the index can be dropped at any time.
+    vector<uint64_t> slots(max(MIN_SLOTS, slots_.size() * 2));
+    while (count_ * 4 > slots.size() * 3) {
+        slots.resize(slots.size() * 2);
+    }
+    size_t mask = slots.size() - 1;
+    for (uint64_t off = 0; off < buf_.size();) {
+        string_view s {buf_.data() + off};
+        size_t i = hash<string_view>()(s) & mask;
+        while (slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = off + 1;
+        off += s.size() + 1;
+    }
+    slots_.swap(slots);
+}
+
+void NameTable::shrink()
+{
+    buf_.shrink_to_fit();
+    vector<uint64_t>().swap(slots_);
+}
+
+void NameTable::clear()
+{
+    string().swap(buf_);
+    vector<uint64_t>().swap(slots_);
+    count_ = 0;
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef INCLUDE_MERKLEFS_NAMES_
+#define INCLUDE_MERKLEFS_NAMES_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metadata {
+
+/*
+ * Interned string buffer.
+ *
+ * Strings are stored once each, NUL-terminated, and referred to by
+ * byte offset, so repeated names such as LICENSE or __init__.py cost
+ * nothing after the first. The index is an open-addressing table of
+ * offsets into the buffer itself. It is only needed to add strings and
+ * can be dropped once a tree is loaded; the next add() rebuilds it.
+ * Strings must not contain NUL.
+ */
+class NameTable {
+  public:
+    // Return the offset of s, adding it if it is not there yet.
+    uint64_t add(std::string_view s);
+    std::string_view get(uint64_t off, uint32_t len) const
+    {
+        return std::string_view(buf_.data() + off, len);
+    }
+    const char* data() const { return buf_.data(); }
+    // Bytes in the buffer, terminators included.
+    size_t size() const { return buf_.size(); }
+    // Number of distinct strings.
+    size_t count() const { return count_; }
+    // Release the index and any slack in the buffer.
+    void shrink();
+    void clear();
+
+  private:
+    void grow();
+
+    std::string buf_;
+    std::vector<uint64_t> slots_;   // offset + 1, 0 if empty
+    size_t count_ = 0;
+};
+
+}
+
+#endif
@@ -1,29 +1,19 @@
 #include "path.hpp"
 
-#include <cstring>
+using namespace std;
 
-const int SEP = '/';
+constexpr char SEP = '/';
 
-std::string pathsep(const char *&path)
+string_view pathsep(string_view& path)
 {
-    const char *p = path;
-    std::string s;
-
-    if (path == nullptr) {
-        return "";
-    }
-    while (*path == SEP) {
-        ++path;
-    }
-    p = strchr(path, SEP);
-    if (p == nullptr) {
-        s = std::string(path);
-        path = nullptr;
-    } else {
-        s = std::string(path, p);
-        while (*++p == SEP) {
-        }
-        path = *p ? p : nullptr;
+    auto begin = path.find_first_not_of(SEP);
+    if (begin == string_view::npos) {
+        path = string_view();
+        return path;
     }
-    return s;
-}
\ No newline at end of file
+    auto end = path.find(SEP, begin);
+    auto step = path.substr(begin, end - begin);
+    auto next = path.find_first_not_of(SEP, end);
+    path = next == string_view::npos ? string_view() : path.substr(next);
+    return step;
+}
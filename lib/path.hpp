@@ -1,8 +1,11 @@
 #ifndef INCLUDE_MERKLEFS_PATH_
 #define INCLUDE_MERKLEFS_PATH_
 
-#include <string>
+#include <string_view>
 
-std::string pathsep(const char *&path);
+// Split the first component off path without copying it. Separators
+// around the component are skipped, so path is empty once the last
+// component has been taken.
+std::string_view pathsep(std::string_view& path);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,118 @@
+#include "pathcache.hpp"
+
+#include <functional>
+#include <mutex>
+
+using namespace std;
+
+namespace metadata {
+
+PathCache::PathCache(size_t capacity, unsigned shards)
+    : nshards_(shards ? shards : 1), shards_(new Shard[nshards_])
+{
+    capacity_ = (capacity + nshards_ - 1) / nshards_;
+    if (capacity_ == 0) {
+        capacity_ = 1;
+    }
+    for (unsigned i = 0; i < nshards_; ++i) {
+        shards_[i].entries.reset(new Entry[capacity_]);
+        shards_[i].index.reserve(capacity_);
+    }
+}
+
+PathCache::~PathCache() {}
+
+uint64_t PathCache::hash(ino_t parent, string_view path)
+{
+    uint64_t h = std::hash<string_view>()(path);
+    return h ^ (parent * 0x9e3779b97f4a7c15ull);
+}
+
+PathCache::Shard& PathCache::shard(uint64_t h) const
+{
+    // The low bits pick the bucket inside the shard.
+    return shards_[(h >> 32) % nshards_];
+}
+
+ino_t PathCache::get(ino_t parent, string_view path) const
+{
+    auto h = hash(parent, path);
+    auto& s = shard(h);
+    shared_lock<shared_mutex> g {s.m};
+    auto it = s.index.find(h);
+    if (it != s.index.end()) {
+        const auto& e = s.entries[it->second];
+        if (e.parent == parent && e.path == path) {
+            e.referenced.store(true, memory_order_relaxed);
+            hits_.fetch_add(1, memory_order_relaxed);
+            return e.ino;
+        }
+    }
+    misses_.fetch_add(1, memory_order_relaxed);
+    return 0;
+}
+
+void PathCache::put(ino_t parent, string_view path, ino_t ino)
+{
+    auto h = hash(parent, path);
+    auto& s = shard(h);
+    unique_lock<shared_mutex> g {s.m};
+    auto it = s.index.find(h);
+    if (it != s.index.end()) {
+        auto& e = s.entries[it->second];
+        e.path = path;
+        e.parent = parent;
+        e.ino = ino;
+        return;
+    }
+
+    size_t slot;
+    if (s.size < capacity_) {
+        slot = s.size++;
+    } else {
+        // Give every referenced entry a second chance.
+        while (s.entries[s.hand].referenced.exchange(false,
+                                                     memory_order_relaxed)) {
+            s.hand = (s.hand + 1) % capacity_;
+        }
+        slot = s.hand;
+        s.hand = (s.hand + 1) % capacity_;
+        s.index.erase(s.entries[slot].hash);
+    }
+    auto& e = s.entries[slot];
+    e.path = path;
+    e.parent = parent;
+    e.ino = ino;
+    e.hash = h;
+    e.referenced.store(false, memory_order_relaxed);
+    s.index.emplace(h, slot);
+}
+
+void PathCache::clear()
+{
+    for (unsigned i = 0; i < nshards_; ++i) {
+        auto& s = shards_[i];
+        unique_lock<shared_mutex> g {s.m};
+        s.index.clear();
+        s.size = 0;
+        s.hand = 0;
+    }
+}
+
+uint64_t PathCache::hits() const
+{
+    return hits_.load(memory_order_relaxed);
+}
+
+uint64_t PathCache::misses() const
+{
+    return misses_.load(memory_order_relaxed);
+}
+
+double PathCache::hit_rate() const
+{
+    auto h = hits(), m = misses();
+    return h + m ? double(h) / (h + m) : 0;
+}
+
+}
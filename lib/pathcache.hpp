@@ -0,0 +1,69 @@
+#ifndef INCLUDE_MERKLEFS_PATHCACHE_
+#define INCLUDE_MERKLEFS_PATHCACHE_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace metadata {
+
+/*
+ * Concurrent cache of resolved paths, (parent ino, path) -> ino.
+ *
+ * The cache is split into shards by hash. Readers only take a shard
+ * lock shared and mark the entry as referenced; entries are evicted
+ * with the CLOCK algorithm, which approximates LRU without reordering
+ * anything on a hit.
+ */
+class PathCache {
+  public:
+    explicit PathCache(size_t capacity, unsigned shards = 16);
+    ~PathCache();
+    PathCache(const PathCache&) = delete;
+    PathCache& operator=(const PathCache&) = delete;
+
+    // Returns 0 on a miss.
+    ino_t get(ino_t parent, std::string_view path) const;
+    void put(ino_t parent, std::string_view path, ino_t ino);
+    void clear();
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+    double hit_rate() const;
+
+  private:
+    struct Entry {
+        std::string path;
+        ino_t parent = 0;
+        ino_t ino = 0;
+        uint64_t hash = 0;
+        mutable std::atomic<bool> referenced {false};
+    };
+
+    struct Shard {
+        mutable std::shared_mutex m;
+        std::unordered_map<uint64_t, size_t> index;
+        std::unique_ptr<Entry[]> entries;
+        size_t size = 0;
+        size_t hand = 0;
+    };
+
+    static uint64_t hash(ino_t parent, std::string_view path);
+    Shard& shard(uint64_t h) const;
+
+    size_t capacity_;
+    unsigned nshards_;
+    std::unique_ptr<Shard[]> shards_;
+    mutable std::atomic<uint64_t> hits_ {0};
+    mutable std::atomic<uint64_t> misses_ {0};
+};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+  merklediff: list the changes between two MerkleFS metadata versions
+  Copyright (C) 2021       Kaijie Chen <chen@kaijie.org>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+*/
+
+/** @file
+ *
+ * Compares two metadata files (JSON or binary images) and prints one
+ * line per changed path: "+" added, "-" removed, "M" changed. With
+ * --blobs, the hashes of the file contents that the new version needs
+ * and the old one did not have are printed instead, e.g. to prefetch
+ * them into the pool before an upgrade.
+ *
+ * With --tree, the versions are given as root tree hashes in pool and
+ * only the tree objects that differ are read.
+ */
+
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include "lib/diff.hpp"
+#include "lib/image.hpp"
+
+using namespace std;
+using namespace metadata;
+
+static unique_ptr<Image> open_tree(const char *hex, const char *pool)
+{
+    Digest root;
+    if (!digest_from_hex(hex, root)) {
+        throw runtime_error(string("invalid tree hash ") + hex);
+    }
+    return Image::open_tree(root, pool, nullptr);
+}
+
+int main(int argc, char *argv[])
+{
+    bool blobs = argc > 1 && strcmp(argv[1], "--blobs") == 0;
+    auto args = argv + 1 + blobs;
+    int nargs = argc - 1 - blobs;
+    bool tree = nargs == 4 && strcmp(args[0], "--tree") == 0;
+    if (nargs != 2 && !tree) {
+        cerr << "Usage: " << argv[0] << " [--blobs] <old> <new>\n"
+             << "       " << argv[0]
+             << " [--blobs] --tree <pool> <old-hash> <new-hash>" << endl;
+        return 2;
+    }
+
+    Diff d;
+    try {
+        auto from = tree ? open_tree(args[2], args[1]) : load_image(args[0]);
+        auto to = tree ? open_tree(args[3], args[1]) : load_image(args[1]);
+        d = diff(*from, *to);
+    } catch (const exception& e) {
+        cerr << argv[0] << ": " << e.what() << endl;
+        return 1;
+    }
+
+    if (blobs) {
+        for (const auto& b : d.blobs)
+            cout << digest_to_hex(b) << '\n';
+        return 0;
+    }
+    for (const auto& p : d.removed)
+        cout << "- " << p << '\n';
+    for (const auto& p : d.added)
+        cout << "+ " << p << '\n';
+    for (const auto& p : d.changed)
+        cout << "M " << p << '\n';
+    return 0;
+}
@@ -14,11 +14,26 @@
  * MerkleFS builds a read-only filesystem from a "metadata" file.
  * OverlayFS should be used to support writes.
  *
+ * The metadata is either a JSON file or a binary image produced by
+ * mkmerklefs. Images are mmap()ed and served in place, so mounting
+ * does not depend on the size of the filesystem. With --tree, the
+ * metadata is instead the hash of a root tree object in the pool and
+ * each directory is loaded (or fetched) when it is first accessed.
+ *
+ * Sending SIGUSR1 reloads the metadata file and swaps it in without a
+ * remount. Inode numbers of unchanged entries are kept, only entries
+ * that differ are invalidated in the kernel, and files that are open
+ * keep reading their old blobs. The new image must replace the old one
+ * by rename(), as mkmerklefs does, never by rewriting the file: the old
+ * one stays mapped.
+ *
  * 3 types of filemodes are supported: REG, DIR, and SYMLINK.
  * The content of REG files is stored as blobs in a "pool".
  * Those blobs are names in their hash value, and were referenced
- * by the hash value in "metadata". File contents are served using
- * FUSE passthrough to be as efficient and correct as possible.
+ * by the hash value in "metadata". Where the kernel supports it
+ * (Linux 6.9, libfuse 3.16), open files are backed by their pool blobs
+ * with FUSE passthrough, so reads and mmap never leave the kernel.
+ * Otherwise reads are spliced from the blob.
  *
  * If any blob is missing in this "pool", MerkleFS will try to
  * fetch it from "remote", and file contents can be loaded lazily.
@@ -47,6 +62,7 @@
 #include <string.h>
 #include <sys/file.h>
 #include <sys/resource.h>
+#include <signal.h>
 #include <sys/xattr.h>
 #include <time.h>
 #include <unistd.h>
@@ -58,45 +74,203 @@
 #include <cstdio>
 #include <cstdlib>
 #include <list>
+#include <numeric>
 #include "cxxopts.hpp"
 #include <mutex>
 #include <fstream>
 #include <thread>
 #include <iomanip>
-#include "lib/metadata.hpp"
+#include "lib/image.hpp"
+#include "lib/attr.hpp"
+#include "lib/epochs.hpp"
 #include "lib/config.hpp"
+#include "lib/diff.hpp"
+#include "lib/files.hpp"
+#include "lib/listing.hpp"
 #include "lib/fetcher.hpp"
 
 using namespace std;
 using namespace metadata;
-using nlohmann::json;
 
-struct File {
-    int fd {-1};
-    int nopen {0};
+// Encoded listings are kept up to this many bytes per Meta.
+constexpr size_t LISTING_CACHE_BYTES = 64 << 20;
+
+/*
+ * The inode numbers known to the kernel ("mount inos") must stay valid
+ * when the metadata is reloaded, so they are translated to the image
+ * that backs them. Each reload appends a generation: entries that are
+ * unchanged are rebound to the new image, entries that were removed or
+ * changed keep pointing into the image they came from, which stays
+ * mapped. Changed entries are given fresh mount inos, so the kernel
+ * never sees different content under the same inode. A directory whose
+ * tree digest is unchanged is not walked: it keeps the generation that
+ * bound it, and so does everything below it.
+ *
+ * Mount inos of removed or changed entries ("stale" inos) are freed
+ * once the kernel has forgotten them, and images that no mount ino
+ * refers to any more are dropped; see Fs::collect().
+ */
+struct Meta {
+    static constexpr int GEN_SHIFT = 48;
+    static constexpr uint64_t INO_MASK = (uint64_t{1} << GEN_SHIFT) - 1;
+    static constexpr uint64_t STALE = uint64_t{1} << 63;
+
+    vector<shared_ptr<const Image>> images;
+    // mount ino -> STALE | generation << GEN_SHIFT | image ino; empty:
+    // identity
+    vector<uint64_t> to_image;
+    // per generation, ino in its image -> mount ino; null: identity
+    vector<shared_ptr<const vector<fuse_ino_t>>> to_mount;
+
+    const Image& image() const {
+        return *images.back();
+    }
+
+    static uint64_t gen(uint64_t v) {
+        return (v & ~STALE) >> GEN_SHIFT;
+    }
+
+    // Returns the image backing ino, or nullptr if ino is unknown.
+    const Image* resolve(fuse_ino_t ino, ino_t& iino) const {
+        uint64_t gen;
+        return resolve(ino, iino, gen);
+    }
+
+    const Image* resolve(fuse_ino_t ino, ino_t& iino, uint64_t& g) const {
+        if (to_image.empty()) {
+            iino = ino;
+            g = 0;
+            return images[0].get();
+        }
+        if (ino >= to_image.size() || to_image[ino] == 0) {
+            iino = 0;
+            g = 0;
+            return nullptr;
+        }
+        iino = to_image[ino] & INO_MASK;
+        g = gen(to_image[ino]);
+        return images[g].get();
+    }
+
+    // Like resolve(), but nullptr for stale inos as well: only the
+    // directories that are in the current tree can be looked into.
+    const Image* live(fuse_ino_t ino, ino_t& iino, uint64_t& g) const {
+        return stale(ino) ? nullptr : resolve(ino, iino, g);
+    }
+
+    // True if ino is known but not in the current tree.
+    bool stale(fuse_ino_t ino) const {
+        return ino < to_image.size() && (to_image[ino] & STALE);
+    }
 
-    std::mutex m;
+    // The mount ino of iino in the image of generation g.
+    fuse_ino_t mount_ino(uint64_t g, ino_t iino) const {
+        if (g >= to_mount.size() || !to_mount[g])
+            return iino;
+        const auto& t = *to_mount[g];
+        return iino < t.size() ? t[iino] : 0;
+    }
 
-    // Delete copy constructor and assignments. We could implement
-    // move if we need it.
-    File() = default;
-    File(const File&) = delete;
-    File(File&& inode) = delete;
-    File& operator=(File&& inode) = delete;
-    File& operator=(const File&) = delete;
+    // Listings hold mount inos, so they are cached per Meta, by mount
+    // ino. When the cache is full it starts over.
+    mutable mutex listings_m;
+    mutable unordered_map<fuse_ino_t, shared_ptr<const Listing>> listings;
+    mutable size_t listings_size = 0;
+
+    shared_ptr<const Listing> listing(fuse_ino_t ino) const {
+        lock_guard<mutex> g {listings_m};
+        auto it = listings.find(ino);
+        return it == listings.end() ? nullptr : it->second;
+    }
+
+    void cache(fuse_ino_t ino, shared_ptr<const Listing> l) const {
+        lock_guard<mutex> g {listings_m};
+        if (listings_size + l->bytes() > LISTING_CACHE_BYTES) {
+            listings.clear();
+            listings_size = 0;
+        }
+        if (listings.emplace(ino, l).second)
+            listings_size += l->bytes();
+    }
+};
+
+/*
+ * The kernel's lookup count of every mount ino: raised for each entry
+ * it is sent and lowered by forget. The counts are kept in chunks that
+ * are allocated on first use, so they can be updated without a lock
+ * while reloads add mount inos.
+ */
+class Lookups {
+  public:
+    Lookups() = default;
+    ~Lookups() {
+        for (auto& c : chunks_)
+            delete[] c.load();
+    }
+    Lookups(const Lookups&) = delete;
+    Lookups& operator=(const Lookups&) = delete;
+
+    void add(fuse_ino_t ino) {
+        if (auto c = count(ino, true))
+            ++*c;
+    }
+    // Returns the count that is left.
+    uint64_t forget(fuse_ino_t ino, uint64_t n) {
+        auto c = count(ino, true);
+        return c ? *c -= n : 1;
+    }
+    uint64_t get(fuse_ino_t ino) {
+        auto c = count(ino, false);
+        return c ? c->load() : ino >> (2 * CHUNK_BITS) ? 1 : 0;
+    }
 
-    ~File() {
-        if(fd >= 0)
-            close(fd);
+  private:
+    static constexpr int CHUNK_BITS = 16;
+
+    // Inos past the table are never counted, and never freed.
+    atomic<uint64_t>* count(fuse_ino_t ino, bool create) {
+        if (ino >> (2 * CHUNK_BITS))
+            return nullptr;
+        auto& chunk = chunks_[ino >> CHUNK_BITS];
+        auto c = chunk.load();
+        if (!c && create) {
+            auto fresh = new atomic<uint64_t>[size_t{1} << CHUNK_BITS]();
+            if (chunk.compare_exchange_strong(c, fresh))
+                c = fresh;
+            else
+                delete[] fresh;
+        }
+        return c ? &c[ino & ((size_t{1} << CHUNK_BITS) - 1)] : nullptr;
     }
+
+    atomic<atomic<uint64_t>*> chunks_[size_t{1} << CHUNK_BITS] {};
 };
 
-typedef unordered_map<fuse_ino_t, File> FileMap;
+// Stale inos forgotten before a collection is tried from forget.
+constexpr size_t COLLECT_MIN = 1024;
+
+// The current Meta of a request, which is not freed while this is held.
+class Snapshot {
+  public:
+    Snapshot(const Epochs& epochs, const atomic<const Meta*>& meta)
+        : guard_(epochs), meta_(meta.load()) {}
+    const Meta& operator*() const { return *meta_; }
+    const Meta* operator->() const { return meta_; }
+
+  private:
+    Epochs::Guard guard_;
+    const Meta *meta_;
+};
 
 struct Fs {
     Fs() : fetcher(Fetcher{cfg.fetcher()}) {};
-    FileSystem meta;
-    FileMap fmap;
+    // What requests read; set by publish(), which is called with
+    // reload_m held (or before the session starts).
+    atomic<const Meta*> meta {nullptr};
+    Epochs epochs;
+    unique_ptr<const Meta> current;
+    fuse_session *se = nullptr;
+    FileTable files;
     Config cfg;
     Fetcher fetcher;
     double timeout;
@@ -110,51 +284,393 @@ struct Fs {
     timespec mnt_time = {};
     bool nosplice;
     bool nocache;
-    int getattr(fuse_ino_t ino, struct stat& stat);
-    int lookup(fuse_ino_t parent, const char *name, fuse_entry_param& e);
+    bool nopassthrough;
+    bool io_uring;
+    // Set by mfs_init() if the kernel takes backing files.
+    bool passthrough = false;
+    // The attributes every inode shares; set by init_attr().
+    AttrTemplate attr_template;
+    Snapshot snapshot() const {
+        return Snapshot(epochs, meta);
+    }
+    void init_attr();
+    int getattr(const Meta& m, fuse_ino_t ino, struct stat& stat);
+    int entry(const Meta& m, fuse_ino_t ino, fuse_entry_param& e);
+    int lookup(const Meta& m, fuse_ino_t parent, const char *name,
+               fuse_entry_param& e);
+    void reload(shared_ptr<const Image> next);
+
+    Lookups lookups;
+    // Serializes reload() and collect().
+    mutex reload_m;
+    // Replaced snapshots, with the epoch after which no request can
+    // still be reading them.
+    vector<pair<unique_ptr<const Meta>, uint64_t>> retired;
+    void publish(unique_ptr<const Meta> next);
+    // Stale inos the kernel still holds, and how many of them it has
+    // forgotten since.
+    atomic<size_t> stale {0};
+    atomic<size_t> forgotten {0};
+    bool collect();
+    void forget(const Meta& m, fuse_ino_t ino, uint64_t nlookup);
 };
 static Fs fs{};
 
 
-int Fs::getattr(fuse_ino_t ino, struct stat& attr)
+// A file handle is the pool fd, with the passthrough backing id (or 0)
+// in the upper half.
+static inline uint64_t make_fh(int fd, int backing) {
+    return uint64_t(uint32_t(backing)) << 32 | uint32_t(fd);
+}
+
+static inline int fh_fd(uint64_t fh) {
+    return static_cast<int>(fh & 0xffffffff);
+}
+
+static inline int fh_backing(uint64_t fh) {
+    return static_cast<int>(fh >> 32);
+}
+
+
+void Fs::init_attr()
+{
+    attr_template = AttrTemplate(dev, uid, gid, mnt_time, blksize);
+}
+
+
+int Fs::getattr(const Meta& m, fuse_ino_t ino, struct stat& attr)
 {
     if (debug)
         cerr << "DEBUG: getattr(): ino=" << ino << endl;
 
-    if (ino == 0) {
+    ino_t iino;
+    auto img = m.resolve(ino, iino);
+    if (ino == 0 || img == nullptr || !img->valid(iino)) {
         return ENOENT;
     }
 
-    const auto& inode = meta[ino];
-    attr.st_dev = dev;
-    attr.st_ino = ino;
-    attr.st_mode = inode.mode();
-    attr.st_nlink = 1;
-    attr.st_uid = uid;
-    attr.st_gid = gid;
-    attr.st_rdev = 0;
-    attr.st_size = inode.size();
-    attr.st_atim = mnt_time;
-    attr.st_mtim = mnt_time;
-    attr.st_ctim = mnt_time;
-    attr.st_blksize = blksize;
-    attr.st_blocks = inode.size() / 512 + bool(inode.size() % 512);
+    attr_template.fill(*img, iino, ino, attr);
     return 0;
 }
 
 
-int Fs::lookup(fuse_ino_t parent, const char *name, fuse_entry_param& e)
+int Fs::entry(const Meta& m, fuse_ino_t ino, fuse_entry_param& e)
 {
-    if (debug)
-        cerr << "DEBUG: lookup(): parent=" << parent
-             << ", name=" << name << endl;
-
     memset(&e, 0, sizeof(e));
     e.attr_timeout = timeout;
     e.entry_timeout = timeout;
-    e.ino = meta.lookup(parent, name);
+    e.ino = ino;
     e.generation = 0;
-    return getattr(e.ino, e.attr);
+    return getattr(m, ino, e.attr);
+}
+
+
+int Fs::lookup(const Meta& m, fuse_ino_t parent, const char *name,
+               fuse_entry_param& e)
+{
+    if (debug)
+        cerr << "DEBUG: lookup(): parent=" << parent
+             << ", name=" << name << endl;
+
+    // Directories that were removed by a reload cannot be looked into.
+    ino_t iparent;
+    uint64_t gen;
+    auto img = m.live(parent, iparent, gen);
+    if (img == nullptr) {
+        return ENOENT;
+    }
+    auto err = img->fault(iparent);
+    if (err) {
+        return err;
+    }
+    return entry(m, m.mount_ino(gen, img->lookup(iparent, name)), e);
+}
+
+
+/*
+ * Binds the entries of a new image to mount inos by walking it together
+ * with the current tree, and collects the kernel caches to invalidate.
+ * Each directory of the current tree is walked in the image of the
+ * generation its mount ino resolves to, which bound its entries.
+ */
+struct Remap {
+    const Meta& cur;
+    Meta& next;
+    const Image& b;
+    uint64_t gen;
+    // The mount inos of b, in next.
+    vector<fuse_ino_t>& to_mount;
+    vector<pair<fuse_ino_t, string>> entries;
+    vector<fuse_ino_t> inodes;
+    // Freed mount inos, taken from the back.
+    vector<fuse_ino_t> free;
+    // Mount inos of removed or replaced entries.
+    vector<fuse_ino_t> gone;
+
+    Remap(const Meta& cur, Meta& next, vector<fuse_ino_t>& to_mount)
+        : cur(cur), next(next), b(next.image()),
+          gen(next.images.size() - 1), to_mount(to_mount) {}
+
+    // Rebind mount ino mino to bi, unless either is already bound.
+    bool bind(fuse_ino_t mino, ino_t bi) {
+        if (to_mount[bi])
+            return to_mount[bi] == mino;
+        if (Meta::gen(next.to_image[mino]) == gen)
+            return false;
+        to_mount[bi] = mino;
+        next.to_image[mino] = gen << Meta::GEN_SHIFT | bi;
+        return true;
+    }
+
+    // Give bi and everything below it fresh mount inos.
+    void add(ino_t bi) {
+        if (to_mount[bi])
+            return;
+        if (free.empty()) {
+            to_mount[bi] = next.to_image.size();
+            next.to_image.push_back(gen << Meta::GEN_SHIFT | bi);
+        } else {
+            to_mount[bi] = free.back();
+            next.to_image[free.back()] = gen << Meta::GEN_SHIFT | bi;
+            free.pop_back();
+        }
+        if (b.is_dir(bi)) {
+            for (const auto& d : b.dirents(bi))
+                add(d.ino);
+        }
+    }
+
+    // Walk directory mino, which is ai in the image of generation ag.
+    void walk(fuse_ino_t mino, uint64_t ag, ino_t ai, ino_t bi) {
+        const auto& a = *cur.images[ag];
+        auto ta = a.dirents(ai);
+        auto tb = b.dirents(bi);
+        size_t i = 0, j = 0;
+        bool changed = false;
+        while (i < ta.size() || j < tb.size()) {
+            int c = i == ta.size() ? 1 : j == tb.size() ? -1
+                  : a.name(ta[i]).compare(b.name(tb[j]));
+            if (c < 0) {
+                gone.push_back(cur.mount_ino(ag, ta[i].ino));
+                entries.emplace_back(mino, a.name(ta[i++]));
+                changed = true;
+            } else if (c > 0) {
+                add(tb[j].ino);
+                entries.emplace_back(mino, b.name(tb[j++]));
+                changed = true;
+            } else {
+                if (match(cur.mount_ino(ag, ta[i++].ino), tb[j].ino, mino,
+                          b.name(tb[j])))
+                    changed = true;
+                j++;
+            }
+        }
+        // drop the cached listing, which holds the inos of the entries
+        if (changed)
+            inodes.push_back(mino);
+    }
+
+    // Returns true if the entry was replaced by one with a new mount ino.
+    bool match(fuse_ino_t mino, ino_t bi, fuse_ino_t parent, string_view name) {
+        ino_t ai;
+        uint64_t ag;
+        const auto& a = *cur.resolve(mino, ai, ag);
+        if (a.is_dir(ai) && b.is_dir(bi)) {
+            // The tree digest covers the directory and everything below
+            // it: the entries keep the mount inos, and the generation,
+            // they have.
+            if (a.gethash(ai) == b.gethash(bi) && !to_mount[bi]) {
+                to_mount[bi] = mino;
+                return false;
+            }
+            if (bind(mino, bi)) {
+                if (!same_entry(a, ai, b, bi))
+                    inodes.push_back(mino);
+                walk(mino, ag, ai, bi);
+                return false;
+            }
+        }
+        if (!a.is_dir(ai) && same_entry(a, ai, b, bi) && bind(mino, bi))
+            return false;
+        gone.push_back(mino);
+        add(bi);
+        entries.emplace_back(parent, name);
+        return true;
+    }
+
+    // Mark mino stale, and what is below it, unless it was rebound.
+    // Returns how many were marked.
+    size_t retire(fuse_ino_t mino) {
+        auto& v = next.to_image[mino];
+        if (v == 0 || (v & Meta::STALE) || Meta::gen(v) == gen)
+            return 0;
+        v |= Meta::STALE;
+        ino_t ai;
+        uint64_t ag;
+        const auto& a = *cur.resolve(mino, ai, ag);
+        size_t n = 1;
+        if (a.is_dir(ai)) {
+            for (const auto& d : a.dirents(ai))
+                n += retire(cur.mount_ino(ag, d.ino));
+        }
+        return n;
+    }
+};
+
+
+void Fs::reload(shared_ptr<const Image> image)
+{
+    lock_guard<mutex> g {reload_m};
+    collect();
+    const Meta *cur = current.get();
+    auto next = make_unique<Meta>();
+    next->images = cur->images;
+    next->images.push_back(move(image));
+    next->to_image = cur->to_image;
+    if (next->to_image.empty()) {
+        next->to_image.resize(cur->image().next_ino());
+        iota(next->to_image.begin(), next->to_image.end(), 0);
+    }
+    // Generation 0 starts out as the identity.
+    next->to_mount = cur->to_mount;
+    next->to_mount.resize(cur->images.size());
+    auto to_mount = make_shared<vector<fuse_ino_t>>(next->image().next_ino());
+
+    Remap r {*cur, *next, *to_mount};
+    for (auto ino = next->to_image.size() - 1; ino > 0; --ino) {
+        if (next->to_image[ino] == 0)
+            r.free.push_back(ino);
+    }
+    // The root is in the current generation: every reload that changes
+    // anything walks it.
+    const auto& a = cur->image();
+    auto last = cur->images.size() - 1;
+    auto root = cur->mount_ino(last, a.root());
+    // Keep the current generation if nothing the kernel sees differs.
+    if (a.gethash(a.root()) != r.b.gethash(r.b.root())) {
+        r.bind(root, r.b.root());
+        if (!same_entry(a, a.root(), r.b, r.b.root()))
+            r.inodes.push_back(root);
+        r.walk(root, last, a.root(), r.b.root());
+    }
+    if (r.entries.empty() && r.inodes.empty()) {
+        if (debug)
+            cerr << "DEBUG: reload(): no changes" << endl;
+        return;
+    }
+    size_t retired = 0;
+    for (auto mino : r.gone)
+        retired += r.retire(mino);
+    next->to_mount.push_back(move(to_mount));
+    publish(move(next));
+
+    for (const auto& [parent, name] : r.entries)
+        fuse_lowlevel_notify_inval_entry(se, parent, name.data(), name.size());
+    for (auto ino : r.inodes)
+        fuse_lowlevel_notify_inval_inode(se, ino, 0, 0);
+
+    if (debug)
+        cerr << "DEBUG: reload(): invalidated " << r.entries.size()
+             << " entries, " << r.inodes.size() << " inodes, "
+             << retired << " inos stale" << endl;
+}
+
+
+/*
+ * Makes next the snapshot new requests read. The one it replaces is
+ * kept until the requests that may have loaded it are done.
+ */
+void Fs::publish(unique_ptr<const Meta> next)
+{
+    meta = next.get();
+    if (current)
+        retired.emplace_back(move(current), epochs.advance());
+    current = move(next);
+}
+
+
+/*
+ * Frees the stale mount inos the kernel has forgotten, for add() to
+ * reuse, and drops the images no mount ino refers to. Requests that
+ * still read a replaced snapshot may be sending the kernel inos that
+ * are stale now, so nothing is freed until they are done; the replaced
+ * snapshots are freed here as they are. Returns false if it has to wait
+ * for them. Called with reload_m held.
+ */
+bool Fs::collect()
+{
+    auto quiet = remove_if(retired.begin(), retired.end(),
+        [&](const auto& r) { return epochs.quiet(r.second); });
+    retired.erase(quiet, retired.end());
+    if (!retired.empty())
+        return false;
+    forgotten = 0;
+    const Meta *cur = current.get();
+    if (cur->to_image.empty())
+        return true;
+
+    auto next = make_unique<Meta>();
+    next->to_image = cur->to_image;
+    auto& to_image = next->to_image;
+    uint64_t last = cur->images.size() - 1;
+    vector<size_t> refs(cur->images.size());
+    size_t freed = 0, left = 0;
+    for (fuse_ino_t ino = 1; ino < to_image.size(); ++ino) {
+        if (to_image[ino] == 0)
+            continue;
+        bool gone = to_image[ino] & Meta::STALE;
+        if (gone && lookups.get(ino) == 0) {
+            to_image[ino] = 0;
+            ++freed;
+            continue;
+        }
+        left += gone;
+        ++refs[Meta::gen(to_image[ino])];
+    }
+    stale = left;
+
+    // Renumber the generations that are left.
+    vector<uint64_t> renumber(cur->images.size());
+    for (size_t gen = 0; gen < cur->images.size(); ++gen) {
+        if (refs[gen] || gen == last) {
+            renumber[gen] = next->images.size();
+            next->images.push_back(cur->images[gen]);
+            next->to_mount.push_back(gen < cur->to_mount.size()
+                                     ? cur->to_mount[gen] : nullptr);
+        }
+    }
+    if (freed == 0 && next->images.size() == cur->images.size())
+        return true;
+    for (auto& v : to_image) {
+        if (v)
+            v = (v & Meta::STALE) | renumber[Meta::gen(v)] << Meta::GEN_SHIFT
+                | (v & Meta::INO_MASK);
+    }
+    while (to_image.back() == 0 && to_image.size() > 1)
+        to_image.pop_back();
+    auto dropped = cur->images.size() - renumber[last] - 1;
+    publish(move(next));
+
+    if (debug)
+        cerr << "DEBUG: collect(): freed " << freed << " inodes, dropped "
+             << dropped << " images" << endl;
+    return true;
+}
+
+
+// Lower the lookup count of ino, and collect once enough of the stale
+// inos have been forgotten that it is worth a pass over the table.
+void Fs::forget(const Meta& m, fuse_ino_t ino, uint64_t nlookup)
+{
+    if (lookups.forget(ino, nlookup) != 0 || !m.stale(ino))
+        return;
+    auto enough = min<size_t>(stale,
+        max(COLLECT_MIN, m.to_image.size() / 8));
+    if (++forgotten < enough)
+        return;
+    unique_lock<mutex> g {reload_m, try_to_lock};
+    if (g)
+        collect();
 }
 
 
@@ -169,7 +685,25 @@ static void mfs_init(void *userdata, fuse_conn_info *conn) {
     if (conn->capable & FUSE_CAP_EXPORT_SUPPORT)
         conn->want |= FUSE_CAP_EXPORT_SUPPORT;
 
-    if (fs.timeout && conn->capable & FUSE_CAP_WRITEBACK_CACHE)
+#ifdef FUSE_CAP_PASSTHROUGH
+    // The default backing stack depth keeps the pool off stacked
+    // filesystems, and lets OverlayFS stack on top of us.
+    if (conn->capable & FUSE_CAP_PASSTHROUGH && !fs.nopassthrough) {
+        conn->want |= FUSE_CAP_PASSTHROUGH;
+        fs.passthrough = true;
+    }
+#endif
+
+#ifdef FUSE_CAP_OVER_IO_URING
+    // Requests then come through one ring per CPU instead of read(2) and
+    // write(2) on /dev/fuse. The kernel needs fuse.enable_uring=1.
+    if (fs.io_uring && !fuse_set_feature_flag(conn, FUSE_CAP_OVER_IO_URING))
+        cerr << "WARNING: kernel does not offer FUSE over io_uring" << endl;
+#endif
+
+    // Passthrough and writeback cache are conflicting modes.
+    if (fs.timeout && conn->capable & FUSE_CAP_WRITEBACK_CACHE &&
+        !fs.passthrough)
         conn->want |= FUSE_CAP_WRITEBACK_CACHE;
 
     if (conn->capable & FUSE_CAP_FLOCK_LOCKS)
@@ -191,7 +725,7 @@ static void mfs_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
 
     (void)fi;
     struct stat attr;
-    auto err = fs.getattr(ino, attr);
+    auto err = fs.getattr(*fs.snapshot(), ino, attr);
     if (err) {
         fuse_reply_err(req, err);
         return;
@@ -206,76 +740,61 @@ static void mfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
         cerr << "DEBUG: " << __func__ << "(): parent=" << parent
              << ", name=" << name << endl;
 
+    // The snapshot is held until the reply is sent, so that a collection
+    // cannot free the ino before the kernel's count of it is raised.
+    auto m = fs.snapshot();
     fuse_entry_param e {};
-    auto err = fs.lookup(parent, name, e);
+    auto err = fs.lookup(*m, parent, name, e);
     if (err == ENOENT) {
         e.attr_timeout = fs.timeout;
         e.entry_timeout = fs.timeout;
         e.ino = e.attr.st_ino = 0;
         fuse_reply_entry(req, &e);
+    } else if (err) {
+        fuse_reply_err(req, err);
     } else {
+        // The kernel holds on to the ino until it forgets it.
+        fs.lookups.add(e.ino);
         fuse_reply_entry(req, &e);
     }
 }
 
 
-static void mfs_readlink(fuse_req_t req, fuse_ino_t ino) {
+static void mfs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
     if (fs.debug)
-        cerr << "DEBUG: " << __func__ << "(): ino=" << ino << endl;
+        cerr << "DEBUG: " << __func__ << "(): ino=" << ino
+             << ", nlookup=" << nlookup << endl;
 
-    const auto& inode = fs.meta[ino];
-    fuse_reply_readlink(req, inode.readlink().c_str());
+    fs.forget(*fs.snapshot(), ino, nlookup);
+    fuse_reply_none(req);
 }
 
 
-struct Dir {
-    const Inode &inode;
-    Dirents::const_iterator it;
-    off_t offset;
-
-    Dir(const Inode& inode) : inode(inode), offset(0) {
-        it = inode.dirents().cbegin();
-    }
-
-    void seek(off_t off) {
-        if (off < offset) {
-            it = inode.dirents().cbegin();
-            offset = 0;
-        }
-        while (offset < off && next()) {
-        }
-    }
-
-    bool hasNext() {
-        return it != inode.dirents().cend();
-    }
+static void mfs_forget_multi(fuse_req_t req, size_t count,
+                             fuse_forget_data *forgets) {
+    if (fs.debug)
+        cerr << "DEBUG: " << __func__ << "(): count=" << count << endl;
 
-    bool get(const char **namep, ino_t *inop, off_t *offp) {
-        if (!hasNext()) {
-            return false;
-        }
+    auto m = fs.snapshot();
+    for (size_t i = 0; i < count; ++i)
+        fs.forget(*m, forgets[i].ino, forgets[i].nlookup);
+    fuse_reply_none(req);
+}
 
-        *namep = it->first.c_str();
-        *inop = it->second;
-        *offp = offset + 1;
-        return true;
-    }
 
-    bool next() {
-        if (!hasNext()) {
-            return false;
-        }
+static void mfs_readlink(fuse_req_t req, fuse_ino_t ino) {
+    if (fs.debug)
+        cerr << "DEBUG: " << __func__ << "(): ino=" << ino << endl;
 
-        ++it;
-        ++offset;
-        return true;
+    auto m = fs.snapshot();
+    ino_t iino;
+    auto img = m->resolve(ino, iino);
+    if (img == nullptr) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
-
-};
-
-
-static Dir *get_dir(fuse_file_info *fi) {
-    return reinterpret_cast<Dir*>(fi->fh);
+    // strings in the image are NUL-terminated
+    fuse_reply_readlink(req, img->readlink(iino).data());
 }
 
 
@@ -283,19 +802,30 @@ static void mfs_opendir(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
     if (fs.debug)
         cerr << "DEBUG: " << __func__ << "(): ino=" << ino << endl;
 
-    const auto& inode = fs.meta[ino];
-    if (!inode.is_dir()) {
+    auto m = fs.snapshot();
+    ino_t iino;
+    uint64_t gen;
+    auto dir = m->live(ino, iino, gen);
+    if (dir == nullptr) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    const auto& img = *dir;
+    if (!img.is_dir(iino)) {
         fuse_reply_err(req, ENOTDIR);
         return;
     }
 
-    auto d = new (nothrow) Dir{inode};
-    if (d == nullptr) {
-        fuse_reply_err(req, ENOMEM);
+    auto err = img.fault(iino);
+    if (err) {
+        fuse_reply_err(req, err);
         return;
     }
 
-    fi->fh = reinterpret_cast<uint64_t>(d);
+    // Directory handles carry no state: readdir offsets are indexes
+    // into the listing, so every request can start from the current
+    // snapshot.
+    fi->fh = 0;
     if(fs.timeout) {
         fi->keep_cache = 1;
         fi->cache_readdir = 1;
@@ -304,89 +834,132 @@ static void mfs_opendir(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
 }
 
 
-void do_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
-        off_t offset, fuse_file_info *fi, bool plus)
+// Encode every entry of a directory; entries after an error are left
+// out, and err is only set if there are none.
+static shared_ptr<Listing> encode(fuse_req_t req, const Meta& m,
+                                  const Image& img, uint64_t gen,
+                                  const DirentTable& dirents, int& err)
 {
-    auto d = get_dir(fi);
-    auto rem = size;
-    char *p;
-    int err = 0, count = 0;
+    auto l = make_shared<Listing>();
+    l->reserve(dirents.size());
+    off_t off = 0;
+    for (const auto& d : dirents) {
+        auto name = img.name(d).data();
+        struct stat attr;
+        err = fs.getattr(m, m.mount_ino(gen, d.ino), attr);
+        if (err)
+            break;
+        // With no buffer, fuse_add_direntry() returns the size needed.
+        auto entsize = fuse_add_direntry(req, nullptr, 0, name, &attr, off + 1);
+        fuse_add_direntry(req, l->append(entsize), entsize, name, &attr, ++off);
+    }
+    if (err && off > 0) {
+        cerr << "ERROR: readdir(): error code " << err << " after "
+             << off << " entries" << endl;
+        err = 0;
+    }
+    return l;
+}
 
-    if (fs.debug)
-        cerr << "DEBUG: readdir(): started with ino "
-             << ino << " offset " << offset << endl;
 
-    auto buf = new (nothrow) char[size];
-    if (!buf) {
-        fuse_reply_err(req, ENOMEM);
-        return;
+static int readdir(fuse_req_t req, const Meta& m, fuse_ino_t ino,
+                   const Image& img, uint64_t gen,
+                   const DirentTable& dirents, size_t size, off_t offset)
+{
+    auto l = m.listing(ino);
+    if (!l) {
+        int err = 0;
+        auto n = encode(req, m, img, gen, dirents, err);
+        if (err)
+            return err;
+        m.cache(ino, n);
+        l = move(n);
     }
-    p = buf;
-    
-    if (offset != d->offset) {
-        if (fs.debug)
-            cerr << "DEBUG: readdir(): seeking to " << offset << endl;
-        d->seek(offset);
-    }
-
-    const char *d_name;
-    ino_t d_ino;
-    off_t d_off;
-    for (; d->get(&d_name, &d_ino, &d_off); d->next()) {
-        fuse_entry_param e {};
-        size_t entsize;
-        if (plus) {
-            err = fs.lookup(ino, d_name, e);
-            if (err)
-                goto error;
-            entsize = fuse_add_direntry_plus(req, p, rem, d_name, &e, d_off);
-        } else {
-            err = fs.getattr(d_ino, e.attr);
-            if (err)
-                goto error;
-            entsize = fuse_add_direntry(req, p, rem, d_name, &e.attr, d_off);
-        }
-        if (entsize > rem) {
-            if (fs.debug)
-                cerr << "DEBUG: readdir(): buffer full, returning data. " << endl;
-            break;
-        }
 
-        p += entsize;
-        rem -= entsize;
-        count++;
-        if (fs.debug) {
-            cerr << "DEBUG: readdir(): added to buffer: " << d_name
-                 << ", ino " << e.attr.st_ino << ", offset " << d_off << endl;
-        }
+    // Reply with as many whole entries from offset on as fit.
+    auto s = l->slice(offset, size);
+    if (fs.debug)
+        cerr << "DEBUG: readdir(): returning " << s.last - s.first
+             << " entries, curr offset " << s.last << endl;
+    fuse_reply_buf(req, l->data() + s.begin, s.end - s.begin);
+    return 0;
+}
+
+
+static int readdirplus(fuse_req_t req, const Meta& m,
+                       const Image& img, uint64_t gen,
+                       const DirentTable& dirents, size_t size, off_t offset)
+{
+    // Entries with attributes are about as cheap to encode as to copy,
+    // so readdirplus replies are built per request.
+    thread_local string buf;
+    buf.resize(size);
+    size_t used = 0, count = 0;
+    int err = 0;
+    for (size_t k = offset; k < dirents.size(); ++k, ++count) {
+        // The listing already has the ino, no need to look it up.
+        fuse_entry_param e;
+        err = fs.entry(m, m.mount_ino(gen, dirents[k].ino), e);
+        if (err)
+            break;
+        auto name = img.name(dirents[k]).data();
+        auto entsize = fuse_add_direntry_plus(req, &buf[used], size - used,
+                                              name, &e, k + 1);
+        if (entsize > size - used)
+            break;
+        used += entsize;
+        fs.lookups.add(e.ino);
     }
-    err = 0;
-error:
 
     // If there's an error, we can only signal it if we haven't stored
     // any entries yet - otherwise we'd end up with wrong lookup
     // counts for the entries that are already in the buffer. So we
     // return what we've collected until that point.
-    if (err && rem == size) {
-        switch (err) {
-        case ENOENT:
-            cerr << "ERROR: readdir(): no such file or directory" << endl;
-            break;
-        case ENOTDIR:
-            cerr << "ERROR: readdir(): not a directory" << endl;
-            break;
-        default:
-            cerr << "ERROR: readdir(): error code " << err << endl;
-        }
+    if (err && used == 0)
+        return err;
+    if (fs.debug)
+        cerr << "DEBUG: readdirplus(): returning " << count
+             << " entries, curr offset " << offset + count << endl;
+    fuse_reply_buf(req, buf.data(), used);
+    return 0;
+}
+
+
+void do_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t offset, fuse_file_info *fi, bool plus)
+{
+    (void)fi;
+    if (fs.debug)
+        cerr << "DEBUG: readdir(): started with ino "
+             << ino << " offset " << offset << endl;
+
+    auto m = fs.snapshot();
+    ino_t iino;
+    uint64_t gen;
+    auto dir = m->live(ino, iino, gen);
+    if (dir == nullptr) {
+        // Removed by a reload since it was opened: nothing left to list.
+        fuse_reply_buf(req, nullptr, 0);
+        return;
+    }
+    const auto& img = *dir;
+    if (!img.is_dir(iino)) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    int err;
+    try {
+        auto dirents = img.dirents(iino);
+        err = plus ? readdirplus(req, *m, img, gen, dirents, size, offset)
+                   : readdir(req, *m, ino, img, gen, dirents, size, offset);
+    } catch (const bad_alloc&) {
+        err = ENOMEM;
+    }
+    if (err) {
+        cerr << "ERROR: readdir(): error code " << err << endl;
         fuse_reply_err(req, err);
-    } else {
-        if (fs.debug)
-            cerr << "DEBUG: readdir(): returning " << count
-                 << " entries, curr offset " << d->offset << endl;
-        fuse_reply_buf(req, buf, size - rem);
     }
-    delete[] buf;
-    return;
 }
 
 
@@ -404,21 +977,19 @@ static void mfs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
 }
 
 
-static void mfs_releasedir(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
-    if (fs.debug)
-        cerr << "DEBUG: " << __func__ << "(): ino=" << ino << endl;
-
-    auto d = get_dir(fi);
-    delete d;
-    fuse_reply_err(req, 0);
-}
-
-
 static void mfs_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
     if (fs.debug)
         cerr << "DEBUG: " << __func__ << "(): ino=" << ino << endl;
 
-    const auto& inode = fs.meta[ino];
+    // Keep the image alive while its digest is in use.
+    auto m = fs.snapshot();
+    ino_t iino;
+    auto img = m->resolve(ino, iino);
+    if (img == nullptr) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    const auto& digest = img->gethash(iino);
 
     /* With writeback cache, kernel may send read requests even
        when userspace opened write-only */
@@ -436,32 +1007,41 @@ static void mfs_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
     if (fs.timeout && fi->flags & O_APPEND)
         fi->flags &= ~O_APPEND;
 
-    auto& f = fs.fmap[ino];
-
-    lock_guard<mutex> g {f.m};
-    if (f.fd >= 0) {
-        f.nopen++;
-        fi->keep_cache = (fs.timeout != 0);
-        fi->fh = f.fd;
-        fuse_reply_open(req, fi);
+    // Blobs are only ever read. With passthrough, writes would go
+    // straight to the backing file, so it is opened read-only.
+    int flags = fs.passthrough ? O_RDONLY : fi->flags & ~O_NOFOLLOW;
+
+    // Pool files are shared by content, across duplicate inodes and
+    // across generations.
+    auto fd = fs.files.acquire(digest, [&] {
+        // Hashes are kept as raw digests and only spelled out in hex here.
+        string path = fs.cfg.pool() + "/";
+        auto dir_len = path.size();
+        path.resize(dir_len + DIGEST_HEX_LEN);
+        digest_to_hex(digest, path.data() + dir_len);
+        auto fd = open(path.c_str(), flags);
+        if (fd == -1 && fs.fetcher.fetch(path.substr(dir_len))) {
+            // load the object and retry open
+            fd = open(path.c_str(), flags);
+        }
+        return fd;
+    });
+    if (fd < 0) {
+        fuse_reply_err(req, -fd);
         return;
     }
-
-    string path = fs.cfg.pool() + "/" + inode.gethash();
-    auto fd = open(path.c_str(), fi->flags & ~O_NOFOLLOW);
-    if (fd == -1 && fs.fetcher.fetch(inode.gethash())) {
-        // load the object and retry open
-        fd = open(path.c_str(), fi->flags & ~O_NOFOLLOW);
-    }
-    if (fd == -1) {
-        auto err = errno;
-        fuse_reply_err(req, err);
-        return;
+    int backing = 0;
+#ifdef FUSE_CAP_PASSTHROUGH
+    // The kernel takes its own reference to the backing file, the id is
+    // only kept to be closed on release. If it cannot be registered,
+    // this open falls back to mfs_read().
+    if (fs.passthrough) {
+        backing = fuse_passthrough_open(req, fd);
+        fi->backing_id = backing;
     }
-    f.fd = fd;
-    f.nopen = 1;
+#endif
     fi->keep_cache = (fs.timeout != 0);
-    fi->fh = fd;
+    fi->fh = make_fh(fd, backing);
     fuse_reply_open(req, fi);
 }
 
@@ -470,15 +1050,17 @@ static void mfs_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info *fi) {
     if (fs.debug)
         cerr << "DEBUG: " << __func__ << "(): ino=" << ino << endl;
 
-    auto& f = fs.fmap[ino];
-
-    lock_guard<mutex> g {f.m};
-    if (f.nopen <= 0 || f.fd != static_cast<int>(fi->fh)) {
+#ifdef FUSE_CAP_PASSTHROUGH
+    if (auto backing = fh_backing(fi->fh))
+        fuse_passthrough_close(req, backing);
+#endif
+    auto m = fs.snapshot();
+    ino_t iino;
+    auto img = m->resolve(ino, iino);
+    if (img == nullptr ||
+        !fs.files.release(img->gethash(iino), fh_fd(fi->fh))) {
         fuse_reply_err(req, EBADF);
-    }
-
-    if (!--f.nopen) {
-        fs.fmap.erase(ino);
+        return;
     }
     fuse_reply_err(req, 0);
 }
@@ -492,7 +1074,7 @@ static void mfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
     buf.buf[0].flags = static_cast<fuse_buf_flags>(
         FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
-    buf.buf[0].fd = fi->fh;
+    buf.buf[0].fd = fh_fd(fi->fh);
     buf.buf[0].pos = off;
 
     fuse_reply_data(req, &buf, FUSE_BUF_COPY_FLAGS);
@@ -530,15 +1112,14 @@ static void assign_operations(fuse_lowlevel_ops &sfs_oper) {
 //    sfs_oper.unlink = sfs_unlink;
 //    sfs_oper.rmdir = sfs_rmdir;
 //    sfs_oper.rename = sfs_rename;
-//    sfs_oper.forget = sfs_forget;
-//    sfs_oper.forget_multi = sfs_forget_multi;
+    sfs_oper.forget = mfs_forget;
+    sfs_oper.forget_multi = mfs_forget_multi;
     sfs_oper.getattr = mfs_getattr;
 //    sfs_oper.setattr = sfs_setattr;
     sfs_oper.readlink = mfs_readlink;
     sfs_oper.opendir = mfs_opendir;
     sfs_oper.readdir = mfs_readdir;
     sfs_oper.readdirplus = mfs_readdirplus;
-    sfs_oper.releasedir = mfs_releasedir;
 //    sfs_oper.fsyncdir = sfs_fsyncdir;
 //    sfs_oper.create = sfs_create;
     sfs_oper.open = mfs_open;
@@ -562,7 +1143,8 @@ static void assign_operations(fuse_lowlevel_ops &sfs_oper) {
 
 static void print_usage(char *prog_name) {
     cout << "Usage: " << prog_name << " --help\n"
-         << "       " << prog_name << " [options] <metadata> <mountpoint>\n";
+         << "       " << prog_name << " [options] <metadata> <mountpoint>\n"
+         << "       " << prog_name << " [options] --tree <hash> <mountpoint>\n";
 }
 
 static cxxopts::ParseResult parse_wrapper(cxxopts::Options& parser, int& argc, char**& argv) {
@@ -584,7 +1166,10 @@ static cxxopts::ParseResult parse_options(int argc, char **argv) {
         ("help", "Print help")
         ("nocache", "Disable all caching")
         ("nosplice", "Do not use splice(2) to transfer data")
+        ("nopassthrough", "Do not use FUSE passthrough for file contents")
+        ("io-uring", "Take requests over io_uring if the kernel supports it")
         ("single", "Run single-threaded")
+        ("tree", "Load directories lazily from the tree object <hash>")
         ("o", "FUSE mount option", cxxopts::value<std::vector<std::string>>());
 
     // FIXME: Find a better way to limit the try clause to just
@@ -608,26 +1193,137 @@ static cxxopts::ParseResult parse_options(int argc, char **argv) {
 
     fs.debug = options.count("debug") != 0;
     fs.nosplice = options.count("nosplice") != 0;
-    ifstream i {argv[1]};
-    json j;
-    i >> j;
-    fs.meta = j.get<FileSystem>();
+    fs.nopassthrough = options.count("nopassthrough") != 0;
+    fs.io_uring = options.count("io-uring") != 0;
+    // The fixed pool reads every request from the session fd: libfuse
+    // has no way to send a reply to a clone the request came from.
+    if (fs.cfg.threads() && fs.cfg.clone_fd() && !options.count("single")) {
+        std::cout << argv[0] << ": clone_fd needs threads to be 0\n";
+        exit(2);
+    }
+    if (options.count("tree")) {
+        Digest root;
+        if (!digest_from_hex(argv[1], root)) {
+            std::cout << argv[0] << ": invalid tree hash\n";
+            exit(2);
+        }
+        auto m = make_unique<Meta>();
+        m->images.push_back(Image::open_tree(root, fs.cfg.pool(),
+            [](const string& key) { return fs.fetcher.fetch(key); }));
+        fs.publish(move(m));
+    } else {
+        // Binary images are mapped in place, JSON metadata is converted.
+        auto m = make_unique<Meta>();
+        m->images.push_back(load_image(argv[1]));
+        fs.publish(move(m));
+    }
 
     return options;
 }
 
 
-static void maximize_fd_limit() {
+// Reload the metadata on SIGUSR1. The signal is blocked in every thread
+// and taken here, so the (slow) load runs outside signal context. The
+// snapshots that reloads and collections replace are freed here too,
+// checked every second, once the requests that read them are done; the
+// first collection after a reload runs then.
+static void reload_loop(string path) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    for (;;) {
+        timespec tick {1, 0};
+        if (sigtimedwait(&set, nullptr, &tick) < 0) {
+            lock_guard<mutex> g {fs.reload_m};
+            if (!fs.retired.empty())
+                fs.collect();
+            continue;
+        }
+        try {
+            fs.reload(load_image(path));
+        } catch (const exception& e) {
+            cerr << "ERROR: reload(): " << e.what() << endl;
+        }
+    }
+}
+
+
+// One worker of the fixed pool: the loop of fuse_session_loop(), on
+// CPU cpu unless it is negative. Only the request in flight is kept
+// from cancellation. The first worker to fail stores its error.
+static void session_worker(fuse_session *se, int cpu, atomic<int> *error) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            cerr << "WARNING: cannot pin worker to CPU " << cpu << endl;
+    }
+    fuse_buf buf {};
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+    while (!fuse_session_exited(se)) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+        int res = fuse_session_receive_buf(se, &buf);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+        if (res == -EINTR)
+            continue;
+        if (res <= 0) {
+            // -ENODEV: the filesystem was unmounted.
+            int none = 0;
+            if (res < 0 && res != -ENODEV)
+                error->compare_exchange_strong(none, res);
+            break;
+        }
+        fuse_session_process_buf(se, &buf);
+    }
+    free(buf.mem);
+    fuse_session_exit(se);
+}
+
+
+// Runs n workers, the calling thread being the first, all reading the
+// session fd (clone_fd is refused with the pool). Signals are only
+// taken by the calling thread, and once it leaves the loop the others,
+// which may be blocked on /dev/fuse, are cancelled like libfuse does.
+// Returns 0 or the first error, negated, as fuse_session_loop_mt() does.
+static int session_loop_pool(fuse_session *se, unsigned n, bool pin) {
+    unsigned ncpus = max(1u, thread::hardware_concurrency());
+    auto cpu = [&](unsigned i) { return pin ? int(i % ncpus) : -1; };
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    atomic<int> error {0};
+    vector<thread> workers;
+    for (unsigned i = 1; i < n; ++i)
+        workers.emplace_back(session_worker, se, cpu(i), &error);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    session_worker(se, cpu(0), &error);
+    for (auto& w : workers)
+        pthread_cancel(w.native_handle());
+    for (auto& w : workers)
+        w.join();
+    return error;
+}
+
+
+// Returns the new soft limit.
+static rlim_t maximize_fd_limit() {
     struct rlimit lim {};
     auto res = getrlimit(RLIMIT_NOFILE, &lim);
     if (res != 0) {
         warn("WARNING: getrlimit() failed with");
-        return;
+        return 1024;
     }
+    auto cur = lim.rlim_cur;
     lim.rlim_cur = lim.rlim_max;
     res = setrlimit(RLIMIT_NOFILE, &lim);
-    if (res != 0)
+    if (res != 0) {
         warn("WARNING: setrlimit() failed with");
+        return cur;
+    }
+    return lim.rlim_cur;
 }
 
 
@@ -639,9 +1335,13 @@ int main(int argc, char *argv[]) {
     // We need an fd for every dentry in our the filesystem that the
     // kernel knows about. This is way more than most processes need,
     // so try to get rid of any resource softlimit.
-    maximize_fd_limit();
+    auto fd_limit = maximize_fd_limit();
+    // Released pool files stay open so that reopening them is free. Half
+    // of the descriptors are left for files in use and everything else.
+    fs.files.set_idle_limit(fd_limit == RLIM_INFINITY ? 1 << 20 : fd_limit / 2);
 
     fs.timeout = options.count("nocache") ? 0 : 86400.0;
+    fs.init_attr();
 
     // Initialize fuse
     fuse_args args = FUSE_ARGS_INIT(0, nullptr);
@@ -651,6 +1351,15 @@ int main(int argc, char *argv[]) {
         (options.count("debug-fuse") && fuse_opt_add_arg(&args, "-odebug")))
         errx(3, "ERROR: Out of memory");
 
+#ifdef FUSE_CAP_OVER_IO_URING
+    if (fs.io_uring && (fuse_opt_add_arg(&args, "-o") ||
+                        fuse_opt_add_arg(&args, "io_uring")))
+        errx(3, "ERROR: Out of memory");
+#else
+    if (fs.io_uring)
+        warnx("WARNING: built without FUSE over io_uring, ignoring --io-uring");
+#endif
+
     auto fuseopts = options.count("o")
 	    ? options["o"].as<std::vector<std::string>>()
 	    : std::vector<std::string>();
@@ -670,24 +1379,42 @@ int main(int argc, char *argv[]) {
 
     if (fuse_set_signal_handlers(se) != 0)
         goto err_out2;
+    fs.se = se;
 
     // Don't apply umask, use modes exactly as specified
     umask(0);
 
     if (!fs.debug)
         daemon(1, 0);
+
+    // Tree mounts are named by their root hash and have nothing to reload.
+    if (!options.count("tree")) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr);
+        thread(reload_loop, string(argv[1])).detach();
+    }
+
     // Mount and run main loop
     struct fuse_loop_config loop_config;
-    loop_config.clone_fd = 0;
-    loop_config.max_idle_threads = 10;
+    loop_config.clone_fd = fs.cfg.clone_fd();
+    loop_config.max_idle_threads = fs.cfg.max_idle_threads();
     if (fuse_session_mount(se, argv[2]) != 0)
         goto err_out3;
     if (options.count("single"))
         ret = fuse_session_loop(se);
+    else if (fs.cfg.threads())
+        ret = session_loop_pool(se, fs.cfg.threads(), fs.cfg.pin_threads());
     else
         ret = fuse_session_loop_mt(se, &loop_config);
 
     fuse_session_unmount(se);
+    if (fs.debug) {
+        auto st = fs.files.stats();
+        cerr << "DEBUG: pool files: " << st.hits << " hits, " << st.opens
+             << " opens, " << st.evictions << " evictions" << endl;
+    }
 
 err_out3:
     fuse_remove_signal_handlers(se);
@@ -0,0 +1,69 @@
+/*
+  mkmerklefs: compile MerkleFS JSON metadata into a binary image
+  Copyright (C) 2021       Kaijie Chen <chen@kaijie.org>
+
+  This program can be distributed under the terms of the GNU GPLv2.
+  See the file COPYING.
+*/
+
+/** @file
+ *
+ * Reads a JSON "metadata" file and writes the equivalent binary image,
+ * which merklefs can mmap() at mount time instead of parsing JSON.
+ * The image is written next to its destination and renamed into
+ * place, so a mount that has the old image mapped keeps reading it
+ * until it reloads. Images must never be rewritten in place: pages of
+ * a truncated mapping fault with SIGBUS.
+ *
+ * With --tree, every directory is instead stored as a tree object in
+ * the given pool and the hash of the root tree is printed; pass it to
+ * merklefs --tree to load directories on demand.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <unistd.h>
+
+#include "lib/image.hpp"
+#include "lib/metadata.hpp"
+
+using namespace std;
+using namespace metadata;
+
+int main(int argc, char *argv[])
+{
+    bool tree = argc == 4 && strcmp(argv[1], "--tree") == 0;
+    if (argc != 3 && !tree) {
+        cerr << "Usage: " << argv[0] << " <metadata.json> <image>\n"
+             << "       " << argv[0] << " --tree <metadata.json> <pool>"
+             << endl;
+        return 2;
+    }
+
+    FileSystem meta;
+    try {
+        meta.load(argv[tree ? 2 : 1]);
+        if (tree) {
+            cout << digest_to_hex(write_tree(meta, argv[3])) << endl;
+            return 0;
+        }
+    } catch (const exception& e) {
+        cerr << argv[0] << ": " << e.what() << endl;
+        return 1;
+    }
+
+    string path = argv[2];
+    string tmp = path + ".tmp";
+    ofstream o {tmp, ios::binary | ios::trunc};
+    write_image(meta, o);
+    o.close();
+    if (!o || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        cerr << argv[0] << ": failed to write " << path << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "../lib/attr.hpp"
+#include "../lib/epochs.hpp"
+#include "../lib/image.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Cost of building getattr and readdirplus replies over every inode of
+// an image:
+//   test_attr <metadata> [rounds]
+// Attributes are filled by AttrTemplate, as merklefs fills them, alone
+// and with a snapshot taken per call: an atomic shared_ptr load, as
+// snapshot() did, and an epoch guard with a plain pointer load, as it
+// does now. readdirplus entries are built with the ino looked up by
+// name in the parent, and with the ino the listing already has.
+
+static shared_ptr<const Image> meta;
+static atomic<const Image*> published;
+static Epochs epochs;
+static const AttrTemplate attr_template {0, 1000, 1000, {1600000000, 0}, 4096};
+
+template <class F>
+static void run(const char *label, size_t n, unsigned rounds, F f)
+{
+    size_t sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; ++r)
+        sum += f();
+    auto secs = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+    printf("%-32s %8.1f M/s  (%zx)\n", label, n * rounds / secs / 1e6, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <metadata> [rounds]" << endl;
+        return 1;
+    }
+    unsigned rounds = argc > 2 ? stoul(argv[2]) : 10;
+    meta = load_image(argv[1]);
+    const Image& img = *meta;
+
+    ino_t first = img.root(), last = img.next_ino();
+    size_t entries = 0;
+    for (ino_t ino = first; ino < last; ++ino) {
+        if (img.is_dir(ino))
+            entries += img.dirents(ino).size();
+    }
+    cout << last - first << " inodes, " << entries << " dirents" << endl;
+
+    published = meta.get();
+
+    run("getattr", last - first, rounds, [&] {
+        size_t sum = 0;
+        struct stat attr;
+        for (ino_t ino = first; ino < last; ++ino) {
+            attr_template.fill(img, ino, ino, attr);
+            sum += attr.st_size ^ attr.st_ino;
+        }
+        return sum;
+    });
+    run("getattr, shared_ptr snapshot", last - first, rounds, [&] {
+        size_t sum = 0;
+        struct stat attr;
+        for (ino_t ino = first; ino < last; ++ino) {
+            auto m = atomic_load(&meta);
+            attr_template.fill(*m, ino, ino, attr);
+            sum += attr.st_size ^ attr.st_ino;
+        }
+        return sum;
+    });
+    run("getattr, epoch snapshot", last - first, rounds, [&] {
+        size_t sum = 0;
+        struct stat attr;
+        for (ino_t ino = first; ino < last; ++ino) {
+            Epochs::Guard g {epochs};
+            attr_template.fill(*published.load(), ino, ino, attr);
+            sum += attr.st_size ^ attr.st_ino;
+        }
+        return sum;
+    });
+
+    auto readdirplus = [&](bool by_name) {
+        return [&, by_name] {
+            size_t sum = 0;
+            struct stat attr;
+            for (ino_t dir = first; dir < last; ++dir) {
+                if (!img.is_dir(dir))
+                    continue;
+                for (const auto& d : img.dirents(dir)) {
+                    ino_t ino = by_name ? img.lookup(dir, img.name(d)) : d.ino;
+                    attr_template.fill(img, ino, ino, attr);
+                    sum += attr.st_size ^ attr.st_ino;
+                }
+            }
+            return sum;
+        };
+    };
+    run("readdirplus, lookup by name", entries, rounds, readdirplus(true));
+    run("readdirplus, listing ino", entries, rounds, readdirplus(false));
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../lib/image.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Replays the lookups of Python imports against an image:
+//   test_bloom <image or metadata> <search dir>...
+// Every name in the search dirs is imported as a module; each import
+// probes every search dir for the suffixes CPython tries until one
+// exists, plus a few modules that do not exist at all. The trace runs
+// through Image::lookup and through a plain directory search, and the
+// filter's memory and false positive rate are reported.
+
+static const char *const SUFFIXES[] = {
+    "", ".cpython-311-x86_64-linux-gnu.so", ".abi3.so", ".so", ".py", ".pyc",
+};
+
+static const char *const MISSING[] = {
+    "numpy", "yaml", "simplejson", "_frozen_importlib_external", "ujson",
+    "sitecustomize", "usercustomize", "readline", "certifi", "six",
+};
+
+struct Probe {
+    ino_t dir;
+    string name;
+};
+
+static string stem(string_view name)
+{
+    return string(name.substr(0, name.find('.')));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <image or metadata> <search dir>..."
+             << endl;
+        return 1;
+    }
+    auto img = load_image(argv[1]);
+    vector<ino_t> dirs;
+    vector<string> modules {begin(MISSING), end(MISSING)};
+    for (int i = 2; i < argc; ++i) {
+        ino_t ino = img->lookup(img->root(), argv[i]);
+        if (ino == 0 || !img->is_dir(ino)) {
+            cerr << argv[i] << ": not a directory" << endl;
+            return 1;
+        }
+        dirs.push_back(ino);
+        for (const auto& d : img->dirents(ino))
+            modules.push_back(stem(img->name(d)));
+    }
+    sort(modules.begin(), modules.end());
+    modules.erase(unique(modules.begin(), modules.end()), modules.end());
+
+    vector<Probe> trace;
+    size_t hits = 0;
+    for (const auto& m : modules) {
+        bool found = false;
+        for (ino_t dir : dirs) {
+            for (auto suffix : SUFFIXES) {
+                trace.push_back(Probe{dir, m + suffix});
+                if (img->lookup(dir, trace.back().name) != 0) {
+                    found = true;
+                    break;
+                }
+            }
+            if (found)
+                break;
+        }
+        hits += found;
+    }
+    cout << trace.size() << " lookups for " << modules.size() << " imports, "
+         << trace.size() - hits << " misses" << endl;
+
+    auto filter = img->filter();
+    if (filter == nullptr) {
+        cout << "no filter" << endl;
+        return 0;
+    }
+    size_t misses = 0, passed = 0;
+    for (const auto& p : trace) {
+        if (img->lookup(p.dir, p.name) == 0) {
+            ++misses;
+            passed += filter->may_contain(p.dir, p.name);
+        }
+    }
+    cout << "filter: " << filter->keys() << " names, " << filter->memory() / 1024
+         << " KiB, false positives " << 100.0 * passed / misses << "%" << endl;
+
+    auto search = [&](const Probe& p) {
+        auto table = img->dirents(p.dir);
+        auto it = lower_bound(table.begin(), table.end(), p.name,
+            [&](const DirentRecord& d, const string& s) {
+                return img->name(d) < s;
+            });
+        return it != table.end() && img->name(*it) == p.name;
+    };
+    auto lookup = [&](const Probe& p) {
+        return img->lookup(p.dir, p.name) != 0;
+    };
+    auto replay = [&](const char *label, auto find) {
+        size_t found = 0;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < 20; ++r)
+            for (const auto& p : trace)
+                found += find(p);
+        auto end = chrono::steady_clock::now();
+        cout << label << ": " << chrono::duration<double, nano>(end - start)
+                .count() / (20 * trace.size())
+             << " ns per lookup, " << found / 20 << " found" << endl;
+    };
+    replay("search", search);
+    replay("lookup", lookup);
+    return 0;
+}
@@ -18,7 +18,11 @@ int main(int argc, char *argv[])
     
     cout << "pool: " << cfg.pool() << endl
         << "remote: " << cfg.remote() << endl
-        << "fetcher: " << cfg.fetcher() << endl;
+        << "fetcher: " << cfg.fetcher() << endl
+        << "threads: " << cfg.threads() << endl
+        << "max_idle_threads: " << cfg.max_idle_threads() << endl
+        << "clone_fd: " << cfg.clone_fd() << endl
+        << "pin_threads: " << cfg.pin_threads() << endl;
 
     return 0;
 }
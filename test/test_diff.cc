@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../lib/diff.hpp"
+#include "../lib/image.hpp"
+#include "../lib/metadata.hpp"
+
+using namespace std;
+using namespace metadata;
+
+const string H1(64, '1'), H2(64, '2'), H3(64, '3');
+
+const string OLD = R"([
+    {"ino": 1, "mode": 16877, "size": 0,
+     "dirents": {"etc": 2, "usr": 3, "gone": 6}},
+    {"ino": 2, "mode": 16877, "size": 0, "dirents": {"motd": 4}},
+    {"ino": 3, "mode": 16877, "size": 0, "dirents": {"lib": 5}},
+    {"ino": 4, "mode": 33188, "size": 5, "value": ")" + H1 + R"("},
+    {"ino": 5, "mode": 16877, "size": 0, "dirents": {}},
+    {"ino": 6, "mode": 41471, "size": 3, "value": "etc"}
+])";
+
+const string NEW = R"([
+    {"ino": 1, "mode": 16877, "size": 0,
+     "dirents": {"etc": 2, "usr": 3, "new": 6}},
+    {"ino": 2, "mode": 16877, "size": 0, "dirents": {"motd": 4, "moved": 7}},
+    {"ino": 3, "mode": 16877, "size": 0, "dirents": {"lib": 5}},
+    {"ino": 4, "mode": 33188, "size": 5, "value": ")" + H2 + R"("},
+    {"ino": 5, "mode": 16877, "size": 0, "dirents": {}},
+    {"ino": 6, "mode": 33188, "size": 5, "value": ")" + H3 + R"("},
+    {"ino": 7, "mode": 33188, "size": 5, "value": ")" + H1 + R"("}
+])";
+
+FileSystem parse(const string& json)
+{
+    FileSystem fs;
+    istringstream is {json};
+    fs.load(is);
+    return fs;
+}
+
+unique_ptr<Image> image(const FileSystem& fs)
+{
+    ostringstream os;
+    write_image(fs, os);
+    return Image::from_string(os.str());
+}
+
+void print(const Diff& d)
+{
+    for (const auto& p : d.removed)
+        cout << "- " << p << endl;
+    for (const auto& p : d.added)
+        cout << "+ " << p << endl;
+    for (const auto& p : d.changed)
+        cout << "M " << p << endl;
+    for (const auto& b : d.blobs)
+        cout << "blob " << digest_to_hex(b) << endl;
+}
+
+void test_images()
+{
+    auto a = parse(OLD), b = parse(NEW);
+    auto ia = image(a), ib = image(b);
+
+    cout << "same " << diff(*ia, *image(a)).changed.size() << endl;
+    cout << "old -> new" << endl;
+    print(diff(*ia, *ib));
+    cout << "new -> old" << endl;
+    print(diff(*ib, *ia));
+}
+
+void test_trees()
+{
+    char pool[] = "/tmp/test_diff.XXXXXX";
+    if (mkdtemp(pool) == nullptr) {
+        perror("mkdtemp");
+        return;
+    }
+    auto a = parse(OLD), b = parse(NEW);
+    auto ta = Image::open_tree(write_tree(a, pool), pool, nullptr);
+    auto tb = Image::open_tree(write_tree(b, pool), pool, nullptr);
+
+    // /usr is identical and is never loaded.
+    cout << "tree old -> new" << endl;
+    print(diff(*ta, *tb));
+    cout << "loaded " << tb->next_ino() - tb->root() << endl;
+
+    // A flat image and a tree of the same metadata have no changes.
+    cout << "flat vs tree " << diff(*image(b), *tb).changed.size() << endl;
+
+    filesystem::remove_all(pool);
+}
+
+int main()
+{
+    test_images();
+    test_trees();
+    return 0;
+}
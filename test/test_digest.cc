@@ -0,0 +1,36 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../lib/digest.hpp"
+
+using namespace std;
+
+int main()
+{
+    const string hex =
+        "0123456789abcdef00ff10e0a5c3f7b1deadbeefcafebabe8badf00d0ddba11a";
+    Digest d;
+
+    cout << "parse: " << digest_from_hex(hex, d) << endl;
+    cout << "roundtrip: " << (digest_to_hex(d) == hex) << endl;
+    cout << "upper: " << digest_from_hex(
+        "0123456789ABCDEF00FF10E0A5C3F7B1DEADBEEFCAFEBABE8BADF00D0DDBA11A", d)
+         << " " << (digest_to_hex(d) == hex) << endl;
+    cout << "short: " << digest_from_hex("abcd", d) << endl;
+    cout << "bad digit: " << digest_from_hex(string(63, '0') + "g", d) << endl;
+
+    const int rounds = 10000000;
+    char out[DIGEST_HEX_LEN];
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        d[i % d.size()] = i;
+        digest_to_hex(d, out);
+        asm volatile("" : : "r"(out) : "memory");
+    }
+    auto end = chrono::steady_clock::now();
+    cout << "to_hex: "
+         << chrono::duration<double, nano>(end - start).count() / rounds
+         << " ns/digest" << endl;
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "../lib/image.hpp"
+#include "../lib/metadata.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Directory lookup throughput across directory sizes:
+//   test_dirindex [max entries]
+// Each size gets a flat image with one directory of sharded names,
+// which is searched by binary search and through a DirIndex, for hits
+// in random order and for misses. The last column is Image::lookup,
+// which picks one of the two by DIR_INDEX_MIN.
+
+static unique_ptr<Image> make_image(size_t n, vector<string>& names)
+{
+    mt19937_64 rng {n};
+    names.clear();
+    ostringstream js;
+    js << "[{\"ino\":1,\"mode\":" << (S_IFDIR | 0755) << ",\"size\":0,"
+       << "\"dirents\":{";
+    char buf[32];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), "shard-%016llx",
+                 (unsigned long long)rng());
+        names.push_back(buf);
+        js << (i ? "," : "") << '"' << buf << "\":" << i + 2;
+    }
+    js << "}}";
+    for (size_t i = 0; i < n; ++i) {
+        js << ",{\"ino\":" << i + 2 << ",\"mode\":" << (S_IFLNK | 0777)
+           << ",\"size\":0,\"value\":\"x\"}";
+    }
+    js << "]";
+    FileSystem fs;
+    istringstream is {js.str()};
+    fs.load(is);
+    ostringstream os;
+    write_image(fs, os);
+    return Image::from_string(os.str());
+}
+
+template <class Find>
+static double bench(const vector<string>& probes, Find find)
+{
+    size_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < 4; ++r)
+        for (const auto& p : probes)
+            found += find(p);
+    auto end = chrono::steady_clock::now();
+    if (found == size_t(-1))
+        cout << found;
+    return chrono::duration<double, nano>(end - start).count()
+        / (4 * probes.size());
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_n = argc > 1 ? stoul(argv[1]) : 1 << 20;
+    cout << "entries  search(ns)  index(ns)  miss-search  miss-index"
+         << "  lookup(ns)  index KiB" << endl;
+    vector<string> names;
+    for (size_t n = 16; n <= max_n; n *= 4) {
+        auto img = make_image(n, names);
+        auto table = img->dirents(img->root());
+        auto name_at = [&](size_t k) { return img->name(table[k]); };
+        DirIndex index {table.size(), name_at};
+
+        vector<string> hits, misses;
+        mt19937_64 rng {42};
+        for (size_t i = 0; i < 200000; ++i) {
+            hits.push_back(names[rng() % n]);
+            misses.push_back(names[rng() % n] + "~");
+        }
+        auto search = [&](const string& s) {
+            auto it = lower_bound(table.begin(), table.end(), s,
+                [&](const DirentRecord& d, const string& s) {
+                    return img->name(d) < s;
+                });
+            return it != table.end() && img->name(*it) == s;
+        };
+        auto hashed = [&](const string& s) {
+            return index.find(s, name_at) != SIZE_MAX;
+        };
+        auto lookup = [&](const string& s) {
+            return img->lookup(img->root(), s) != 0;
+        };
+        printf("%7zu  %10.1f  %9.1f  %11.1f  %10.1f  %10.1f  %9zu\n", n,
+               bench(hits, search), bench(hits, hashed),
+               bench(misses, search), bench(misses, hashed),
+               bench(hits, lookup), index.memory() / 1024);
+    }
+    return 0;
+}
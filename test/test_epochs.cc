@@ -0,0 +1,92 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../lib/epochs.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Objects published as merklefs publishes its snapshots:
+//   test_epochs [threads] [seconds]
+// Readers take a guard, load the pointer and check the object, while a
+// writer replaces it and frees what it replaced once quiet() allows.
+// A freed object is poisoned first, so a reader that could still reach
+// one counts it as a failure.
+
+struct Object {
+    uint64_t value;
+    uint64_t check;
+};
+
+constexpr uint64_t POISON = 0xdeaddeaddeaddeadULL;
+
+static Epochs epochs;
+static atomic<Object*> current;
+
+int main(int argc, char *argv[])
+{
+    unsigned threads = argc > 1 ? stoul(argv[1]) : 4;
+    double seconds = argc > 2 ? stod(argv[2]) : 1;
+
+    current = new Object {0, ~0ULL};
+    atomic<bool> stop {false};
+    atomic<size_t> reads {0}, failures {0};
+    vector<thread> readers;
+    for (unsigned t = 0; t < threads; ++t) {
+        readers.emplace_back([&] {
+            size_t n = 0, bad = 0;
+            while (!stop) {
+                Epochs::Guard g {epochs};
+                // A nested guard leaves the outer one in charge.
+                Epochs::Guard inner {epochs};
+                const Object *o = current.load();
+                if (o->value == POISON || o->check != ~o->value)
+                    ++bad;
+                ++n;
+            }
+            reads += n;
+            failures += bad;
+        });
+    }
+
+    vector<pair<Object*, uint64_t>> retired;
+    size_t published = 0, freed = 0;
+    auto end = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+    while (chrono::steady_clock::now() < end) {
+        ++published;
+        auto old = current.exchange(new Object {published, ~published});
+        retired.emplace_back(old, epochs.advance());
+        for (auto it = retired.begin(); it != retired.end();) {
+            if (!epochs.quiet(it->second)) {
+                ++it;
+                continue;
+            }
+            it->first->value = POISON;
+            delete it->first;
+            it = retired.erase(it);
+            ++freed;
+        }
+    }
+    stop = true;
+    for (auto& r : readers)
+        r.join();
+    for (auto& [o, epoch] : retired) {
+        if (epochs.quiet(epoch))
+            ++freed;
+        delete o;
+    }
+    delete current.load();
+
+    cout << "published " << published << ", freed "
+         << (freed == published ? "all" : "some") << endl;
+    cout << "readers " << epochs.readers() << endl;
+    cout << (failures ? "FAILED" : "ok") << ": " << (reads ? "reads" : "no reads")
+         << ", " << failures << " of a freed object" << endl;
+    return failures != 0;
+}
@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../lib/files.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Open storm against the open-file table:
+//   test_files [inodes] [opens per thread] [copies]
+// Every thread keeps a window of files open and replaces the oldest on
+// each step, with inodes drawn so that a few (the shared libraries) are
+// hot. Each content is shared by copies inodes, as duplicated files are
+// in an image. FileTable runs against a map under one lock, which is what the
+// table replaces, for rising thread counts, then again keeping a
+// quarter of the contents open when idle. At the end no file may be left
+// open but the idle ones.
+
+static int open_null()
+{
+    return open("/dev/null", O_RDONLY);
+}
+
+// The same interface under a single lock.
+class LockedTable {
+  public:
+    int acquire(const Digest& key, const FileTable::Opener& open)
+    {
+        lock_guard<mutex> g {m_};
+        auto& f = files_[key];
+        if (f.refs == 0) {
+            f.fd = open();
+            if (f.fd < 0) {
+                files_.erase(key);
+                return -1;
+            }
+        }
+        ++f.refs;
+        return f.fd;
+    }
+    bool release(const Digest& key, int fd)
+    {
+        lock_guard<mutex> g {m_};
+        auto it = files_.find(key);
+        if (it == files_.end() || it->second.fd != fd)
+            return false;
+        if (--it->second.refs == 0) {
+            close(fd);
+            files_.erase(it);
+        }
+        return true;
+    }
+    size_t size() const { return files_.size(); }
+
+  private:
+    struct File {
+        int fd;
+        unsigned refs = 0;
+    };
+    mutex m_;
+    unordered_map<Digest, File, DigestHash> files_;
+};
+
+template <class Table>
+static double storm(Table& table, unsigned threads,
+                    const vector<Digest>& inodes, size_t ops)
+{
+    size_t keys = inodes.size();
+    constexpr size_t WINDOW = 16;
+    auto worker = [&](unsigned id) {
+        mt19937_64 rng {id};
+        const Digest *window[WINDOW];
+        int fds[WINDOW];
+        for (size_t i = 0; i < ops + WINDOW; ++i) {
+            size_t slot = i % WINDOW;
+            if (i >= WINDOW && !table.release(*window[slot], fds[slot])) {
+                cerr << "release failed" << endl;
+                exit(1);
+            }
+            if (i >= ops)
+                continue;
+            // Half of the opens go to 1% of the keys.
+            auto r = rng();
+            window[slot] = &inodes[(r & 1) ? (r >> 1) % (keys / 100 + 1)
+                                           : (r >> 1) % keys];
+            fds[slot] = table.acquire(*window[slot], open_null);
+            if (fds[slot] < 0) {
+                cerr << "open failed" << endl;
+                exit(1);
+            }
+        }
+    };
+    vector<thread> pool;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+        pool.emplace_back(worker, t);
+    for (auto& t : pool)
+        t.join();
+    auto end = chrono::steady_clock::now();
+    return threads * ops / chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t keys = argc > 1 ? stoul(argv[1]) : 4096;
+    size_t ops = argc > 2 ? stoul(argv[2]) : 100000;
+    size_t copies = argc > 3 ? stoul(argv[3]) : 1;
+    size_t contents = max<size_t>(1, keys / copies);
+    vector<Digest> inodes;
+    for (size_t i = 0; i < keys; ++i)
+        inodes.push_back(digest_sha256(to_string(i % contents)));
+    unsigned max_threads = max(16u, 2 * thread::hardware_concurrency());
+    cout << thread::hardware_concurrency() << " cpus, " << keys
+         << " inodes, " << contents << " contents" << endl;
+    cout << "threads  locked(Mops/s)  sharded(Mops/s)  opens"
+         << "  cached(Mops/s)  opens  hit rate" << endl;
+    for (unsigned t = 1; t <= max_threads; t *= 2) {
+        LockedTable locked;
+        FileTable sharded, cached;
+        cached.set_idle_limit(contents / 4);
+        double l = storm(locked, t, inodes, ops);
+        double s = storm(sharded, t, inodes, ops);
+        double c = storm(cached, t, inodes, ops);
+        auto st = sharded.stats(), ct = cached.stats();
+        printf("%7u  %14.2f  %15.2f  %5zu  %14.2f  %5zu  %7.1f%%\n", t,
+               l / 1e6, s / 1e6, st.opens, c / 1e6, ct.opens,
+               100.0 * ct.hits / (ct.hits + ct.opens));
+        if (locked.size() != 0 || sharded.size() != 0
+                || cached.size() != cached.stats().idle) {
+            cerr << "files left open" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <cinttypes>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../lib/listing.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Directory listings as merklefs serves them:
+//   test_listing [entries] [threads]
+// Listing::slice() is checked first: at every offset, including past
+// the end, with replies ending just before, at and after entry
+// boundaries. Then a directory is listed the way the kernel reads it,
+// each request resuming at the offset of the last entry it got, for
+// several reply sizes. Every entry has to come back exactly once and in
+// order, from the cached listing as from readdirplus replies encoded
+// per request. The time to list the whole directory in 4 KiB requests
+// is compared for plain entries from the cache, and for entries with
+// attributes from the cache and encoded per request. Last, rising
+// numbers of threads read the cached listing at once, as processes
+// that list the same large directory do.
+
+// Entries in the layout of the kernel protocol: struct fuse_dirent,
+// a 24-byte header and the name padded to 8 bytes, preceded for
+// readdirplus by the 128-byte struct fuse_entry_out.
+constexpr size_t DIRENT_HEADER = 24;
+constexpr size_t ENTRY_OUT = 128;
+
+static size_t add_entry(char *buf, size_t bufsize, const string& name,
+                        uint64_t ino, uint64_t off, bool plus)
+{
+    size_t head = plus ? ENTRY_OUT : 0;
+    size_t entsize = head + ((DIRENT_HEADER + name.size() + 7) & ~size_t{7});
+    if (entsize > bufsize)
+        return entsize;
+    memset(buf, 0, entsize);
+    if (plus)
+        memcpy(buf, &ino, sizeof(ino));
+    uint32_t namelen = name.size();
+    char *d = buf + head;
+    memcpy(d, &ino, sizeof(ino));
+    memcpy(d + 8, &off, sizeof(off));
+    memcpy(d + 16, &namelen, sizeof(namelen));
+    memcpy(d + DIRENT_HEADER, name.data(), namelen);
+    return entsize;
+}
+
+static uint64_t ino_of(size_t k)
+{
+    return 1000 + k;
+}
+
+static vector<string> make_names(size_t n)
+{
+    vector<string> names;
+    for (size_t k = 0; k < n; ++k)
+        names.push_back(string(k % 23 + 1, 'a' + k % 26) + to_string(k));
+    return names;
+}
+
+static Listing encode(const vector<string>& names, bool plus)
+{
+    Listing l;
+    l.reserve(names.size());
+    for (size_t k = 0; k < names.size(); ++k) {
+        auto entsize = add_entry(nullptr, 0, names[k], ino_of(k), k + 1, plus);
+        add_entry(l.append(entsize), entsize, names[k], ino_of(k), k + 1, plus);
+    }
+    return l;
+}
+
+// Returns the bytes of a reply starting at offset.
+typedef function<size_t(uint64_t offset, size_t size, char *buf)> Reply;
+
+static Reply cached(const Listing& l)
+{
+    return [&l](uint64_t offset, size_t size, char *buf) {
+        auto s = l.slice(offset, size);
+        memcpy(buf, l.data() + s.begin, s.end - s.begin);
+        return s.end - s.begin;
+    };
+}
+
+// As merklefs builds readdirplus replies.
+static Reply per_request(const vector<string>& names)
+{
+    return [&names](uint64_t offset, size_t size, char *buf) {
+        size_t used = 0;
+        for (size_t k = offset; k < names.size(); ++k) {
+            auto entsize = add_entry(buf + used, size - used, names[k],
+                                     ino_of(k), k + 1, true);
+            if (entsize > size - used)
+                break;
+            used += entsize;
+        }
+        return used;
+    };
+}
+
+// List the directory as the kernel does; returns the number of
+// requests, or 0 if an entry is missing, repeated or out of order.
+static size_t list(const vector<string>& names, const Reply& reply,
+                   size_t size, bool plus)
+{
+    vector<char> buf(size);
+    uint64_t offset = 0;
+    size_t requests = 0, next = 0;
+    for (;;) {
+        size_t len = reply(offset, size, buf.data());
+        ++requests;
+        if (len == 0)
+            break;
+        for (size_t pos = 0; pos < len;) {
+            const char *d = &buf[pos] + (plus ? ENTRY_OUT : 0);
+            uint64_t ino, off;
+            uint32_t namelen;
+            memcpy(&ino, d, sizeof(ino));
+            memcpy(&off, d + 8, sizeof(off));
+            memcpy(&namelen, d + 16, sizeof(namelen));
+            if (next >= names.size() || off != next + 1 || ino != ino_of(next)
+                    || names[next] != string(d + DIRENT_HEADER, namelen))
+                return 0;
+            ++next;
+            offset = off;
+            pos += (plus ? ENTRY_OUT : 0)
+                + ((DIRENT_HEADER + namelen + 7) & ~size_t{7});
+        }
+    }
+    return next == names.size() ? requests : 0;
+}
+
+// Entries of 16, 24, 8, 40 and 16 bytes.
+static bool test_slices()
+{
+    Listing l;
+    for (size_t len : {16, 24, 8, 40, 16})
+        memset(l.append(len), 'x', len);
+    struct {
+        uint64_t offset;
+        size_t size;
+        Listing::Slice want;
+    } cases[] = {
+        {0, 0, {0, 0, 0, 0}},
+        {0, 15, {0, 0, 0, 0}},
+        {0, 16, {0, 1, 0, 16}},
+        {0, 39, {0, 1, 0, 16}},
+        {0, 40, {0, 2, 0, 40}},
+        {1, 24, {1, 2, 16, 40}},
+        {2, 48, {2, 4, 40, 88}},
+        {3, 1000, {3, 5, 48, 104}},
+        {4, 16, {4, 5, 88, 104}},
+        {5, 4096, {5, 5, 104, 104}},
+        {6, 4096, {5, 5, 104, 104}},
+        {UINT64_MAX, 4096, {5, 5, 104, 104}},
+    };
+    bool ok = true;
+    for (const auto& c : cases) {
+        auto s = l.slice(c.offset, c.size);
+        bool same = s.first == c.want.first && s.last == c.want.last
+            && s.begin == c.want.begin && s.end == c.want.end;
+        printf("slice(%" PRIu64 ", %zu): entries [%zu, %zu), bytes [%zu, %zu)%s\n",
+               c.offset, c.size, s.first, s.last, s.begin, s.end,
+               same ? "" : "  FAILED");
+        ok = ok && same;
+    }
+
+    // Every offset and size against a walk over the entries.
+    vector<size_t> ends = {16, 40, 48, 88, 104};
+    size_t checked = 0;
+    for (uint64_t offset = 0; offset <= ends.size() + 1; ++offset) {
+        for (size_t size = 0; size <= 112; ++size, ++checked) {
+            size_t first = min<size_t>(offset, ends.size());
+            size_t begin = first ? ends[first - 1] : 0, last = first;
+            while (last < ends.size() && ends[last] - begin <= size)
+                ++last;
+            auto s = l.slice(offset, size);
+            if (s.first != first || s.last != last || s.begin != begin
+                    || s.end != (last > first ? ends[last - 1] : begin)) {
+                printf("slice(%" PRIu64 ", %zu): FAILED\n", offset, size);
+                ok = false;
+            }
+        }
+    }
+    cout << checked << " slices checked" << endl;
+
+    Listing empty;
+    auto s = empty.slice(0, 4096);
+    cout << "empty listing: " << s.last - s.first << " entries" << endl;
+    return ok && s.first == 0 && s.last == 0 && s.end == 0;
+}
+
+static bool check(const char *label, const vector<string>& names,
+                  const Reply& reply, bool plus)
+{
+    bool ok = true;
+    for (size_t size : {256, 1000, 4096, 65536, 1 << 20}) {
+        auto requests = list(names, reply, size, plus);
+        cout << label << ", " << size << " bytes: ";
+        if (requests)
+            cout << names.size() << " entries in " << requests << " requests";
+        else
+            cout << "FAILED";
+        cout << endl;
+        ok = ok && requests;
+    }
+    return ok;
+}
+
+static void bench(const char *label, const vector<string>& names,
+                 const Reply& reply, bool plus)
+{
+    constexpr int ROUNDS = 5;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; ++r)
+        list(names, reply, 4096, plus);
+    auto secs = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count() / ROUNDS;
+    printf("%-26s %8.2f ms  %6.1f M entries/s\n", label, secs * 1e3,
+           names.size() / secs / 1e6);
+}
+
+static void concurrent(const vector<string>& names, const Listing& l,
+                       unsigned threads)
+{
+    for (unsigned t = 1; t <= threads; t *= 2) {
+        vector<thread> readers;
+        vector<size_t> requests(t);
+        auto start = chrono::steady_clock::now();
+        for (unsigned k = 0; k < t; ++k) {
+            readers.emplace_back([&, k] {
+                requests[k] = list(names, cached(l), 4096, false);
+            });
+        }
+        for (auto& r : readers)
+            r.join();
+        auto secs = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+        for (auto r : requests) {
+            if (r == 0) {
+                cerr << "FAILED" << endl;
+                exit(1);
+            }
+        }
+        printf("readdir, cached, %3u threads %8.1f M entries/s\n", t,
+               t * names.size() / secs / 1e6);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? stoul(argv[1]) : 1 << 20;
+    unsigned threads = argc > 2 ? stoul(argv[2])
+                                : 2 * thread::hardware_concurrency();
+    if (!test_slices())
+        return 1;
+
+    auto names = make_names(n);
+    auto plain = encode(names, false);
+    auto plus = encode(names, true);
+
+    bool ok = check("readdir, cached", names, cached(plain), false);
+    ok = check("readdirplus, cached", names, cached(plus), true) && ok;
+    ok = check("readdirplus, per request", names, per_request(names), true)
+        && ok;
+    if (!ok)
+        return 1;
+
+    bench("readdir, cached", names, cached(plain), false);
+    bench("readdirplus, cached", names, cached(plus), true);
+    bench("readdirplus, per request", names, per_request(names), true);
+
+    concurrent(names, plain, threads);
+    return 0;
+}
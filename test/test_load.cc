@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "../lib/metadata.hpp"
+
+using namespace std;
+using namespace metadata;
+using nlohmann::json;
+
+// Compare the json DOM loader with the streaming and parallel loaders:
+//   test_load dom <metadata>
+//   test_load sax <metadata>
+//   test_load par <metadata> [threads [huge]]
+// Run each mode in its own process so peak RSS is not shared.
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc > 5) {
+        cerr << "Usage: " << argv[0]
+             << " dom|sax|par <metadata> [threads [huge]]" << endl;
+        return 2;
+    }
+
+    auto start = chrono::steady_clock::now();
+    ifstream i {argv[2]};
+    FileSystem fs {1, argc == 5 && strcmp(argv[4], "huge") == 0};
+    if (strcmp(argv[1], "dom") == 0) {
+        json j;
+        i >> j;
+        fs = j.get<FileSystem>();
+    } else if (strcmp(argv[1], "par") == 0) {
+        fs.load(argv[2], argc >= 4 ? stoi(argv[3]) : 0);
+    } else {
+        fs.load(i);
+    }
+    auto end = chrono::steady_clock::now();
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    cout << argv[1] << ": " << fs.next_ino() - fs.root() << " inodes, "
+         << chrono::duration<double>(end - start).count() << " s, "
+         << "peak RSS " << ru.ru_maxrss / 1024 << " MiB" << endl;
+    cout << "/usr/bin/env = " << fs.lookup(fs.root(), "usr/bin/env") << endl;
+
+    // Resolve the path of every inode once, in tree order.
+    vector<string> paths;
+    function<void(ino_t, const string&)> walk = [&](ino_t ino, const string& p) {
+        for (const auto& d : fs[ino].dirents()) {
+            auto path = p + "/" + string(fs.name(d));
+            paths.push_back(path);
+            if (fs[d.ino].is_dir())
+                walk(d.ino, path);
+        }
+    };
+    walk(fs.root(), "");
+    start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (const auto& p : paths)
+        found += fs.lookup(fs.root(), p) != 0;
+    end = chrono::steady_clock::now();
+    cout << "lookup: " << found << " paths, "
+         << chrono::duration<double, nano>(end - start).count() / paths.size()
+         << " ns each" << endl;
+
+    start = chrono::steady_clock::now();
+    fs = FileSystem();
+    end = chrono::steady_clock::now();
+    cout << "teardown: " << chrono::duration<double>(end - start).count()
+         << " s" << endl;
+    return 0;
+}
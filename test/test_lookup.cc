@@ -0,0 +1,85 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../lib/image.hpp"
+#include "../lib/metadata.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Negative lookup storm, as seen from PATH and Python import probing:
+//   test_lookup <metadata> [threads] [lookups per thread]
+// Every thread count from 1 to threads runs the same number of lookups
+// per thread; with a lock-free lookup throughput scales with the
+// threads and the resident set stays flat.
+
+static long rss_kib()
+{
+    long pages = 0, resident = 0;
+    ifstream i {"/proc/self/statm"};
+    i >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static const char *const PROBES[] = {
+    "usr/bin/python3.9", "usr/lib/__pycache__", "usr/lib/site.cpython-39.so",
+    "usr/bin/env/missing", "missing", "usr/lib/d1/d2/d3/d4/__init__.py",
+};
+
+template <class Lookup>
+static void storm(const char *label, unsigned threads, long n, Lookup lookup)
+{
+    for (unsigned t = 1; t <= threads; t *= 2) {
+        auto before = rss_kib();
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        vector<long> found(t);
+        for (unsigned k = 0; k < t; ++k) {
+            workers.emplace_back([&, k] {
+                for (long i = 0; i < n; ++i)
+                    found[k] += lookup(PROBES[i % size(PROBES)]) != 0;
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        auto secs = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+        long hits = 0;
+        for (auto f : found)
+            hits += f;
+        cout << label << ": " << t << " threads, "
+             << t * n / secs / 1e6 << " M lookups/s, "
+             << hits << " found, RSS " << before << " -> " << rss_kib()
+             << " KiB" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4) {
+        cerr << "Usage: " << argv[0]
+             << " <metadata> [threads] [lookups per thread]" << endl;
+        return 2;
+    }
+    unsigned threads = argc > 2 ? stoi(argv[2]) : thread::hardware_concurrency();
+    long n = argc > 3 ? stol(argv[3]) : 1000000;
+
+    FileSystem meta;
+    meta.load(argv[1]);
+    const FileSystem& fs = meta;
+    storm("metadata", threads, n, [&fs](const char *path) {
+        return fs.lookup(fs.root(), path);
+    });
+
+    auto img = load_image(argv[1]);
+    storm("image", threads, n, [&img](const char *path) {
+        return img->lookup(img->root(), path);
+    });
+    return 0;
+}
@@ -54,9 +54,9 @@ void test_load(const char *metadata)
     cout << "/usr/bin/env = /" << usr << "/" << bin << "/" << env << endl;
 
     cout << "listing /" << endl;
-    const auto& root = fs[1];
-    for (auto it = root.dirents().cbegin(); it != root.dirents().cend(); ++it)
-        cout << it->first << ":" << it->second << endl;
+    auto root = fs[1];
+    for (const auto& d : root.dirents())
+        cout << fs.name(d) << ":" << d.ino << endl;
 }
 
 int main(int argc, char *argv[])
@@ -0,0 +1,68 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../lib/image.hpp"
+#include "../lib/metadata.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Name table memory report:
+//   test_names <metadata>
+// Compares interned names against one std::string per dirent and
+// against a flat buffer that stores every name once per occurrence.
+
+static size_t string_bytes(size_t len)
+{
+    // libstdc++ keeps up to 15 characters inline; longer strings take a
+    // heap block rounded up to 16 bytes.
+    size_t heap = len > 15 ? (len + 1 + 15) / 16 * 16 : 0;
+    return sizeof(string) + heap;
+}
+
+static void row(const char *label, size_t bytes)
+{
+    cout << "  " << label << ": " << bytes / 1024 << " KiB" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <metadata>" << endl;
+        return 1;
+    }
+    FileSystem fs;
+    ifstream i {argv[1]};
+    fs.load(i);
+
+    size_t refs = 0, flat = 0, strings = 0;
+    for (ino_t ino = fs.root(); ino < fs.next_ino(); ++ino) {
+        auto inode = fs[ino];
+        if (inode.is_dir()) {
+            for (const auto& d : inode.dirents()) {
+                ++refs;
+                flat += d.name_len + 1;
+                strings += string_bytes(d.name_len);
+            }
+        } else if (inode.is_lnk()) {
+            auto len = inode.readlink().size();
+            ++refs;
+            flat += len + 1;
+            strings += string_bytes(len);
+        }
+    }
+    const auto& names = fs.names();
+    cout << refs << " names, " << names.count() << " distinct" << endl;
+    row("std::string each", strings);
+    row("flat buffer", flat);
+    row("interned", names.size());
+
+    ostringstream os;
+    write_image(fs, os);
+    auto img = Image::from_string(os.str());
+    cout << "image: " << os.str().size() / 1024 << " KiB, lookup /usr/bin/env = "
+         << img->lookup(img->root(), "usr/bin/env") << endl;
+    return 0;
+}
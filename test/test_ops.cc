@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Request rate and latency of a mount:
+//   test_ops <dir> [threads] [seconds]
+// Every thread stats random paths under dir, then opens and reads the
+// first 4 KiB of each, timing both, and the totals are reported as ops/s
+// with the median and 99th percentile latency. Mount with --nocache so
+// that every call reaches the daemon. Compare runs with and without
+// --io-uring, or across thread counts for the worker settings in the
+// config.
+
+static vector<string> paths;
+
+static int collect(const char *path, const struct stat *, int type, FTW *)
+{
+    if (type == FTW_F)
+        paths.push_back(path);
+    return paths.size() >= 100000;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <dir> [threads] [seconds]" << endl;
+        return 1;
+    }
+    unsigned threads = argc > 2 ? stoul(argv[2]) : 1;
+    double seconds = argc > 3 ? stod(argv[3]) : 5;
+    nftw(argv[1], collect, 64, FTW_PHYS);
+    if (paths.empty()) {
+        cerr << argv[1] << ": no files" << endl;
+        return 1;
+    }
+
+    using clock = chrono::steady_clock;
+    auto deadline = clock::now() + chrono::duration_cast<clock::duration>(
+        chrono::duration<double>(seconds));
+    vector<vector<float>> lat(threads);
+    auto worker = [&](unsigned id) {
+        mt19937_64 rng {id};
+        auto& mine = lat[id];
+        struct stat st;
+        char buf[4096];
+        while (clock::now() < deadline) {
+            const auto& p = paths[rng() % paths.size()];
+            auto start = clock::now();
+            stat(p.c_str(), &st);
+            auto mid = clock::now();
+            int fd = open(p.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                if (pread(fd, buf, sizeof(buf), 0) < 0)
+                    perror(p.c_str());
+                close(fd);
+            }
+            auto end = clock::now();
+            mine.push_back(chrono::duration<float, micro>(mid - start).count());
+            mine.push_back(chrono::duration<float, micro>(end - mid).count());
+        }
+    };
+    auto start = clock::now();
+    vector<thread> pool;
+    for (unsigned t = 0; t < threads; ++t)
+        pool.emplace_back(worker, t);
+    for (auto& t : pool)
+        t.join();
+    double elapsed = chrono::duration<double>(clock::now() - start).count();
+
+    vector<float> all;
+    for (auto& l : lat)
+        all.insert(all.end(), l.begin(), l.end());
+    if (all.empty())
+        return 1;
+    sort(all.begin(), all.end());
+    printf("%zu paths, %u threads: %.0f ops/s, p50 %.1f us, p99 %.1f us\n",
+           paths.size(), threads, all.size() / elapsed,
+           all[all.size() / 2], all[all.size() * 99 / 100]);
+    return 0;
+}
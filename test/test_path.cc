@@ -1,19 +1,86 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <sstream>
 #include <string>
+#include <string_view>
 
+#include "../lib/image.hpp"
+#include "../lib/metadata.hpp"
 #include "../lib/path.hpp"
 
 using namespace std;
+using namespace metadata;
+
+// Count heap allocations so the benchmarks can show that tokenizing
+// and lookup do not allocate.
+static atomic<long> allocations {0};
+
+void *operator new(size_t n)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+template <class F>
+void bench(const char *label, long n, F f)
+{
+    long before = allocations;
+    auto start = chrono::steady_clock::now();
+    long sum = 0;
+    for (long i = 0; i < n; ++i)
+        sum += f();
+    auto ns = chrono::duration<double, nano>(
+        chrono::steady_clock::now() - start).count();
+    cout << label << ": " << ns / n << " ns, "
+         << double(allocations - before) / n << " allocations per call"
+         << " (" << sum / n << ")" << endl;
+}
 
 int main()
 {
-    const char *path = "/usr/bin//env";
-    string s;
+    string_view path = "/usr/bin//env/";
+    while (!path.empty())
+        cout << pathsep(path) << endl;
 
-    while (path != nullptr) {
-        s = pathsep(path);
-        cout << s << endl;
-    }
+    FileSystem fs;
+    fs.mkdir("/usr", 0755);
+    fs.mkdir("/usr/lib", 0755);
+    fs.mkdir("/usr/lib/python3", 0755);
+    fs.mkdir("/usr/lib/python3/site-packages", 0755);
+    fs.creat("/usr/lib/python3/site-packages/six.py", 0644);
+    ostringstream os;
+    write_image(fs, os);
+    auto img = Image::from_string(os.str());
 
+    const char *deep = "usr/lib/python3/site-packages/six.py";
+    const long n = 1000000;
+    bench("pathsep", n, [deep] {
+        string_view p = deep;
+        long k = 0;
+        while (!p.empty())
+            k += pathsep(p).size();
+        return k;
+    });
+    bench("metadata lookup", n, [&fs, deep] {
+        return long(fs.lookup(fs.root(), deep));
+    });
+    bench("image lookup", n, [&img, deep] {
+        return long(img->lookup(img->root(), deep));
+    });
     return 0;
-}
\ No newline at end of file
+}
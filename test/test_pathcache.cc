@@ -0,0 +1,77 @@
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../lib/metadata.hpp"
+#include "../lib/pathcache.hpp"
+
+using namespace std;
+using namespace metadata;
+
+// Resolve deep paths like usr/lib/python3/site-packages/pkgN/modM.py
+// over and over, without the path cache and with caches of different
+// sizes, and report the time per lookup and the hit rate.
+
+static double run(const FileSystem& fs, const vector<string>& paths,
+                  const vector<size_t>& order)
+{
+    auto start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (auto i : order)
+        found += fs.lookup(fs.root(), paths[i]) != 0;
+    auto ns = chrono::duration<double, nano>(
+        chrono::steady_clock::now() - start).count();
+    if (found != order.size())
+        cout << "lookup failed" << endl;
+    return ns / order.size();
+}
+
+int main()
+{
+    FileSystem fs;
+    fs.mkdir("/usr", 0755);
+    fs.mkdir("/usr/lib", 0755);
+    fs.mkdir("/usr/lib/python3", 0755);
+    fs.mkdir("/usr/lib/python3/site-packages", 0755);
+    vector<string> paths;
+    for (int p = 0; p < 500; ++p) {
+        string pkg = "/usr/lib/python3/site-packages/pkg" + to_string(p);
+        fs.mkdir(pkg.c_str(), 0755);
+        for (int m = 0; m < 40; ++m) {
+            string mod = pkg + "/module_" + to_string(m) + ".py";
+            fs.creat(mod.c_str(), 0644);
+            paths.push_back(mod.substr(1));
+        }
+    }
+
+    // Imports hit a small set of modules far more often than the rest.
+    mt19937 rng {1};
+    discrete_distribution<size_t> popular;
+    {
+        vector<double> weights(paths.size());
+        for (size_t i = 0; i < weights.size(); ++i)
+            weights[i] = 1.0 / (i + 1);
+        shuffle(weights.begin(), weights.end(), rng);
+        popular = discrete_distribution<size_t>(weights.begin(), weights.end());
+    }
+    vector<size_t> order(2000000);
+    for (auto& i : order)
+        i = popular(rng);
+
+    cout << paths.size() << " paths, " << order.size() << " lookups" << endl;
+    cout << "uncached: " << run(fs, paths, order) << " ns" << endl;
+    for (size_t capacity : {1000, 5000, 20000}) {
+        fs.cache_paths(capacity);
+        auto ns = run(fs, paths, order);
+        cout << "cache " << capacity << ": " << ns << " ns, hit rate "
+             << fs.path_cache()->hit_rate() << endl;
+    }
+
+    // Removing a name drops the cached paths.
+    fs.unlinkat(fs.root(), paths[0]);
+    cout << "after unlink: " << fs.lookup(fs.root(), paths[0]) << endl;
+    return 0;
+}
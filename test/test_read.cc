@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Read throughput of a file on a mount:
+//   test_read <file> [merklefs pid]
+// The file is read sequentially in 128 KiB blocks, at random offsets in
+// 4 KiB blocks and through mmap, each after dropping it from the page
+// cache where the kernel allows. CPU time is counted for this process
+// and, given its pid, for the daemon, whose share is what passthrough
+// saves. Compare a mount with and without --nopassthrough.
+
+static double cpu_seconds(pid_t pid)
+{
+    if (pid == 0) {
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+            + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+    }
+    ifstream stat {"/proc/" + to_string(pid) + "/stat"};
+    string line;
+    getline(stat, line);
+    // Fields after the command name, which may contain spaces.
+    auto rest = line.substr(line.rfind(')') + 2);
+    unsigned long long utime = 0, stime = 0;
+    sscanf(rest.c_str(),
+           "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+           &utime, &stime);
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+template <class Read>
+static void run(const char *label, int fd, pid_t daemon, Read read)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    double self = cpu_seconds(0);
+    double other = daemon ? cpu_seconds(daemon) : 0;
+    auto start = chrono::steady_clock::now();
+    size_t done = read();
+    auto end = chrono::steady_clock::now();
+    double gb = done / 1e9;
+    self = cpu_seconds(0) - self;
+    other = daemon ? cpu_seconds(daemon) - other : 0;
+    printf("%-10s %8.1f MB/s  %6.3f cpu-s/GB  %6.3f daemon cpu-s/GB\n", label,
+           done / 1e6 / chrono::duration<double>(end - start).count(),
+           self / gb, other / gb);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <file> [merklefs pid]" << endl;
+        return 1;
+    }
+    pid_t daemon = argc > 2 ? stoi(argv[2]) : 0;
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    size_t size = st.st_size;
+    vector<char> buf(128 << 10);
+
+    run("sequential", fd, daemon, [&] {
+        size_t done = 0;
+        ssize_t n;
+        while ((n = pread(fd, buf.data(), buf.size(), done)) > 0)
+            done += n;
+        return done;
+    });
+    run("random", fd, daemon, [&] {
+        mt19937_64 rng {1};
+        size_t blocks = max<size_t>(1, size / 4096), done = 0;
+        for (size_t i = 0; i < blocks; ++i) {
+            ssize_t n = pread(fd, buf.data(), 4096, rng() % blocks * 4096);
+            if (n > 0)
+                done += n;
+        }
+        return done;
+    });
+    run("mmap", fd, daemon, [&] {
+        auto p = static_cast<const volatile char *>(
+            mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (p == MAP_FAILED)
+            return size_t(0);
+        for (size_t off = 0; off < size; off += 4096)
+            p[off];
+        munmap(const_cast<char *>(p), size);
+        return size;
+    });
+    close(fd);
+    return 0;
+}